@@ -14,66 +14,215 @@
 #include <net/if_arp.h>
 #include <netinet/in.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <features.h>
+#if __GLIBC__ >=2 && __GLIBC_MINOR >= 1
+#include <netpacket/packet.h>
+#else
+#include <asm/types.h>
+#include <linux/if_packet.h>
+#endif
+#include <linux/filter.h>
 
 #include "dhcpd.h"
 #include "debug.h"
 #include "arpping.h"
 
+/* persistent socket the server multiplexes its ARP probes on */
+int arp_socket = -1;
+
+/* recent probe results, direct mapped on the address */
+static struct arp_cache {
+	u_int32_t yiaddr;
+	u_int32_t expires;
+	int in_use;
+} arp_cache[ARP_CACHE_SIZE];
+
+
+/* look up a recent probe of yiaddr.
+ * retn:	1 addr free
+ *		0 addr used
+ *		-1 not probed recently
+ */
+int arp_cache_lookup(u_int32_t yiaddr)
+{
+	struct arp_cache *entry = &arp_cache[ntohl(yiaddr) % ARP_CACHE_SIZE];
+
+	if (entry->yiaddr != yiaddr || entry->expires <= (unsigned long) time(0)) {
+		server_stats.arp_cache_misses++;
+		return -1;
+	}
+	server_stats.arp_cache_hits++;
+	return !entry->in_use;
+}
+
+
+/* remember the result of a probe, is_free as returned by arpping() */
+void arp_cache_store(u_int32_t yiaddr, int is_free)
+{
+	struct arp_cache *entry = &arp_cache[ntohl(yiaddr) % ARP_CACHE_SIZE];
+
+	if (!server_config.arp_cache_ttl) return;
+	entry->yiaddr = yiaddr;
+	entry->expires = time(0) + server_config.arp_cache_ttl;
+	entry->in_use = !is_free;
+}
+
+
+/* fill in an ARP request for yiaddr from ip/mac */
+static void make_arp_request(struct arpMsg *arp, u_int32_t yiaddr, u_int32_t ip, unsigned char *mac)
+{
+	memset(arp, 0, sizeof(struct arpMsg));
+	memcpy(arp->ethhdr.h_dest, MAC_BCAST_ADDR, 6);	/* MAC DA */
+	memcpy(arp->ethhdr.h_source, mac, 6);		/* MAC SA */
+	arp->ethhdr.h_proto = htons(ETH_P_ARP);		/* protocol type (Ethernet) */
+	arp->htype = htons(ARPHRD_ETHER);		/* hardware type */
+	arp->ptype = htons(ETH_P_IP);			/* protocol type (ARP message) */
+	arp->hlen = 6;					/* hardware address length */
+	arp->plen = 4;					/* protocol address length */
+	arp->operation = htons(ARPOP_REQUEST);		/* ARP op code */
+	memcpy(arp->sInaddr, &ip, 4);			/* source IP address */
+	memcpy(arp->sHaddr, mac, 6);			/* source hardware address */
+	memcpy(arp->tInaddr, &yiaddr, 4);		/* target IP address */
+}
+
+
+/* Only let ARP replies to mac through, the chatter on a busy segment
+ * is dropped in the kernel. Offsets are from the Ethernet header. */
+static int attach_arp_filter(int fd, unsigned char *mac)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 18),			/* hlen, plen and op */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0x06040000 | ARPOP_REPLY, 0, 7),
+		BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 14),			/* htype and ptype */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (ARPHRD_ETHER << 16) | ETH_P_IP, 0, 5),
+		BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 32),			/* tHaddr is ours */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 3),
+		BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 36),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 1),
+		BPF_STMT(BPF_RET + BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET + BPF_K, 0),
+	};
+	struct sock_fprog prog;
+
+	code[5].k = (mac[0] << 24) | (mac[1] << 16) | (mac[2] << 8) | mac[3];
+	code[7].k = (mac[4] << 8) | mac[5];
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+
+/* open a filtered ARP socket on ifindex, returns the fd or -1 */
+static int arp_packet_socket(int ifindex, unsigned char *mac)
+{
+	struct sockaddr_ll sock;
+	int fd;
+
+	/* no protocol until it is bound, so nothing is queued before the filter is on */
+	if ((fd = socket(PF_PACKET, SOCK_RAW, 0)) < 0) {
+		LOG(LOG_ERR, "Could not open ARP socket: %s", strerror(errno));
+		return -1;
+	}
+
+	if (attach_arp_filter(fd, mac) < 0)
+		LOG(LOG_INFO, "Could not filter ARP socket, checking every frame: %s", strerror(errno));
+
+	memset(&sock, 0, sizeof(sock));
+	sock.sll_family = AF_PACKET;
+	sock.sll_protocol = htons(ETH_P_ARP);
+	sock.sll_ifindex = ifindex;
+	if (bind(fd, (struct sockaddr *) &sock, sizeof(sock)) < 0) {
+		LOG(LOG_ERR, "Could not bind ARP socket: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/* open the persistent, non blocking ARP socket on ifindex, returns the fd or -1 */
+int open_arp_socket(int ifindex, unsigned char *mac)
+{
+	if ((arp_socket = arp_packet_socket(ifindex, mac)) < 0)
+		return -1;
+
+	if (fcntl(arp_socket, F_SETFL, O_NONBLOCK) < 0) {
+		LOG(LOG_ERR, "Could not set up ARP socket: %s", strerror(errno));
+		close(arp_socket);
+		arp_socket = -1;
+	}
+	return arp_socket;
+}
+
+
+/* send a probe for yiaddr on the persistent socket, the reply comes in through get_arp_reply() */
+int send_arp_probe(u_int32_t yiaddr, u_int32_t ip, unsigned char *mac)
+{
+	struct arpMsg arp;
+
+	make_arp_request(&arp, yiaddr, ip, mac);
+	if (send(arp_socket, &arp, sizeof(arp), 0) < 0) {
+		DEBUG(LOG_ERR, "Could not send ARP probe: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+/* read one frame off the persistent socket.
+ * retn:	1 an ARP reply to mac, the sender's IP is stored in addr
+ *		0 some other frame
+ *		-1 nothing left to read or error
+ */
+int get_arp_reply(unsigned char *mac, u_int32_t *addr)
+{
+	struct arpMsg arp;
+	int bytes;
+
+	if ((bytes = recv(arp_socket, &arp, sizeof(arp), 0)) < 0)
+		return -1;
+	if (bytes < (int) offsetof(struct arpMsg, pad) ||
+	    arp.operation != htons(ARPOP_REPLY) || bcmp(arp.tHaddr, mac, 6))
+		return 0;
+	memcpy(addr, arp.sInaddr, 4);
+	return 1;
+}
+
+
 /* args:	yiaddr - what IP to ping
  *		ip - our ip
  *		mac - our arp address
- *		interface - interface to use
+ *		ifindex - interface to use
  * retn: 	1 addr free
  *		0 addr used
  *		-1 error 
  */  
 
 /* FIXME: match response against chaddr */
-int arpping(u_int32_t yiaddr, u_int32_t ip, unsigned char *mac, char *interface)
+int arpping(u_int32_t yiaddr, u_int32_t ip, unsigned char *mac, int ifindex)
 {
 
 	int	timeout = 2;
-	int 	optval = 1;
-	int	s;			/* socket */
+	int	s = arp_socket;		/* socket */
 	int	rv = 1;			/* return value */
-	struct sockaddr addr;		/* for interface name */
 	struct arpMsg	arp;
 	fd_set		fdset;
 	struct timeval	tm;
 	time_t		prevTime;
 
 
-	if ((s = socket (PF_PACKET, SOCK_PACKET, htons(ETH_P_ARP))) == -1) {
-		LOG(LOG_ERR, "Could not open raw socket");
+	/* use the persistent socket if it is open, a filtered one of our own if not */
+	if (s < 0 && (s = arp_packet_socket(ifindex, mac)) < 0)
 		return -1;
-	}
-	
-	if (setsockopt(s, SOL_SOCKET, SO_BROADCAST, &optval, sizeof(optval)) == -1) {
-		LOG(LOG_ERR, "Could not setsockoptetopt on raw socket");
-		close(s);
-		return -1;
-	}
 
 	/* send arp request */
-	memset(&arp, 0, sizeof(arp));
-	memcpy(arp.ethhdr.h_dest, MAC_BCAST_ADDR, 6);	/* MAC DA */
-	memcpy(arp.ethhdr.h_source, mac, 6);		/* MAC SA */
-	arp.ethhdr.h_proto = htons(ETH_P_ARP);		/* protocol type (Ethernet) */
-	arp.htype = htons(ARPHRD_ETHER);		/* hardware type */
-	arp.ptype = htons(ETH_P_IP);			/* protocol type (ARP message) */
-	arp.hlen = 6;					/* hardware address length */
-	arp.plen = 4;					/* protocol address length */
-	arp.operation = htons(ARPOP_REQUEST);		/* ARP op code */
-	*((u_int *) arp.sInaddr) = ip;			/* source IP address */
-	memcpy(arp.sHaddr, mac, 6);			/* source hardware address */
-	*((u_int *) arp.tInaddr) = yiaddr;		/* target IP address */
-	
-	memset(&addr, 0, sizeof(addr));
-	strcpy(addr.sa_data, interface);
-	if (sendto(s, &arp, sizeof(arp), 0, &addr, sizeof(addr)) < 0)
+	make_arp_request(&arp, yiaddr, ip, mac);
+	if (send(s, &arp, sizeof(arp), 0) < 0)
 		rv = 0;
 	
 	/* wait arp reply, and check it */
@@ -87,10 +236,11 @@ int arpping(u_int32_t yiaddr, u_int32_t ip, unsigned char *mac, char *interface)
 			DEBUG(LOG_ERR, "Error on ARPING request: %s", strerror(errno));
 			if (errno != EINTR) rv = 0;
 		} else if (FD_ISSET(s, &fdset)) {
-			if (recv(s, &arp, sizeof(arp), 0) < 0 ) rv = 0;
-			if (arp.operation == htons(ARPOP_REPLY) && 
+			if (recv(s, &arp, sizeof(arp), 0) < 0) {
+				if (errno != EAGAIN) rv = 0;
+			} else if (arp.operation == htons(ARPOP_REPLY) && 
 			    bcmp(arp.tHaddr, mac, 6) == 0 && 
-			    *((u_int *) arp.sInaddr) == yiaddr) {
+			    !memcmp(arp.sInaddr, &yiaddr, 4)) {
 				DEBUG(LOG_INFO, "Valid arp reply receved for this address");
 				rv = 0;
 				break;
@@ -99,7 +249,7 @@ int arpping(u_int32_t yiaddr, u_int32_t ip, unsigned char *mac, char *interface)
 		timeout -= time(NULL) - prevTime;
 		time(&prevTime);
 	}
-	close(s);
+	if (s != arp_socket) close(s);
 	DEBUG(LOG_INFO, "%salid arp replies for this address", rv ? "No v" : "V");	 
 	return rv;
 }
@@ -24,7 +24,14 @@ struct arpMsg {
 	u_char  pad[18];			/* pad for min. Ethernet payload (60 bytes) */
 };
 
+extern int arp_socket;
+
 /* function prototypes */
-int arpping(u_int32_t yiaddr, u_int32_t ip, unsigned char *arp, char *interface);
+int arpping(u_int32_t yiaddr, u_int32_t ip, unsigned char *arp, int ifindex);
+int open_arp_socket(int ifindex, unsigned char *mac);
+int send_arp_probe(u_int32_t yiaddr, u_int32_t ip, unsigned char *mac);
+int get_arp_reply(unsigned char *mac, u_int32_t *addr);
+int arp_cache_lookup(u_int32_t yiaddr);
+void arp_cache_store(u_int32_t yiaddr, int is_free);
 
 #endif
@@ -0,0 +1,125 @@
+/* checksum_test.c
+ *
+ * Checks checksum() and udp_checksum() against the 16 bit at a time
+ * routine they replaced, and times both. Run by "make check".
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "packet.h"
+
+#define ROUNDS		1000000
+#define BENCH_ROUNDS	2000000
+
+
+/* the old checksum(), reading its 16 bit words with memcpy() so that odd
+ * addresses are fine on any host */
+static u_int16_t ref_checksum(void *addr, int count)
+{
+	int32_t sum = 0;
+	unsigned char *source = addr;
+	u_int16_t word;
+
+	while (count > 1) {
+		memcpy(&word, source, 2);
+		sum += word;
+		source += 2;
+		count -= 2;
+	}
+	if (count > 0) {
+		word = 0;
+		*(unsigned char *) (&word) = *source;
+		sum += word;
+	}
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+
+/* the UDP checksum the old way, over a copy with the pseudo header laid
+ * over the ip header */
+static u_int16_t ref_udp_checksum(struct udp_dhcp_packet *packet, int len)
+{
+	struct udp_dhcp_packet copy;
+
+	memcpy(&copy, packet, len);
+	memset(&copy.ip, 0, sizeof(copy.ip));
+	copy.ip.protocol = IPPROTO_UDP;
+	copy.ip.saddr = packet->ip.saddr;
+	copy.ip.daddr = packet->ip.daddr;
+	copy.ip.tot_len = copy.udp.len;
+	return ref_checksum(&copy, len);
+}
+
+
+static void fill(unsigned char *buf, int len, int mode)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = mode == 0 ? 0xff : mode == 1 ? 0 : rand();
+}
+
+
+static double bench(u_int16_t (*sum)(void *, int), void *buf, int len)
+{
+	volatile unsigned int sink = 0;
+	clock_t start = clock();
+	int i;
+
+	for (i = 0; i < BENCH_ROUNDS; i++)
+		sink += sum(buf, len);
+	return (clock() - start) * 1e9 / CLOCKS_PER_SEC / BENCH_ROUNDS;
+}
+
+
+int main(void)
+{
+	static unsigned char buf[2048];
+	struct udp_dhcp_packet packet;
+	int i, len, offset, mode, bad = 0, bad_udp = 0;
+
+	srand(1);
+	for (i = 0; i < ROUNDS; i++) {
+		len = rand() % 1500;
+		offset = rand() % 8;
+		mode = rand() % 4;
+		fill(buf + offset, len, mode);
+		if (checksum(buf + offset, len) != ref_checksum(buf + offset, len)) {
+			if (bad++ < 10)
+				printf("checksum mismatch: length %d, offset %d\n", len, offset);
+		}
+	}
+
+	for (i = 0; i < ROUNDS / 10; i++) {
+		len = sizeof(packet.ip) + sizeof(packet.udp) + rand() % sizeof(packet.data);
+		fill((unsigned char *) &packet, sizeof(packet), rand() % 4);
+		packet.udp.len = htons(len - sizeof(packet.ip));
+		packet.udp.check = 0;
+		if (udp_checksum(&packet, len) != ref_udp_checksum(&packet, len)) {
+			if (bad_udp++ < 10)
+				printf("udp_checksum mismatch: length %d\n", len);
+		}
+	}
+
+	printf("checksum: %d of %d mismatched\n", bad, ROUNDS);
+	printf("udp_checksum: %d of %d mismatched\n", bad_udp, ROUNDS / 10);
+
+	fill(buf, sizeof(buf), 2);
+	printf("576 bytes: %.1f ns, was %.1f ns\n",
+		bench(checksum, buf, 576), bench(ref_checksum, buf, 576));
+	printf("20 bytes: %.1f ns, was %.1f ns\n",
+		bench(checksum, buf, 20), bench(ref_checksum, buf, 20));
+
+	return bad || bad_udp;
+}
@@ -39,6 +39,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef RX_RING
+#include <sys/mman.h>
+#endif
 
 
 #include "dhcpd.h"
@@ -178,76 +181,179 @@ int send_release(unsigned long server, unsigned long ciaddr)
 }
 
 
-/* return -1 on errors that are fatal for the socket, -2 for those that aren't */
-int get_raw_packet(struct dhcpMessage *payload, int fd)
+/* check a frame from the raw socket and copy out its DHCP payload,
+ * return -1 on errors that are fatal for the socket, -2 for those that aren't */
+static int check_raw_packet(struct udp_dhcp_packet *packet, int bytes, struct dhcpMessage *payload)
 {
-	int bytes;
-	struct udp_dhcp_packet packet;
-	u_int32_t source, dest;
 	u_int16_t check;
 
-	memset(&packet, 0, sizeof(struct udp_dhcp_packet));
-	bytes = read(fd, &packet, sizeof(struct udp_dhcp_packet));
-	if (bytes < 0) {
-		DEBUG(LOG_INFO, "couldn't read on raw listening socket -- ignoring");
-		usleep(500000); /* possible down interface, looping condition */
-		return -1;
-	}
-	
 	if (bytes < (int) (sizeof(struct iphdr) + sizeof(struct udphdr))) {
 		DEBUG(LOG_INFO, "message too short, ignoring");
 		return -2;
 	}
 	
-	if (bytes < ntohs(packet.ip.tot_len)) {
+	if (bytes < ntohs(packet->ip.tot_len)) {
 		DEBUG(LOG_INFO, "Truncated packet");
 		return -2;
 	}
 	
 	/* ignore any extra garbage bytes */
-	bytes = ntohs(packet.ip.tot_len);
+	bytes = ntohs(packet->ip.tot_len);
 	
 	/* Make sure its the right packet for us, and that it passes sanity checks */
-	if (packet.ip.protocol != IPPROTO_UDP || packet.ip.version != IPVERSION ||
-	    packet.ip.ihl != sizeof(packet.ip) >> 2 || packet.udp.dest != htons(CLIENT_PORT) ||
+	if (packet->ip.protocol != IPPROTO_UDP || packet->ip.version != IPVERSION ||
+	    packet->ip.ihl != sizeof(packet->ip) >> 2 || packet->udp.dest != htons(CLIENT_PORT) ||
 	    bytes > (int) sizeof(struct udp_dhcp_packet) ||
-	    ntohs(packet.udp.len) != (short) (bytes - sizeof(packet.ip))) {
+	    ntohs(packet->udp.len) != (short) (bytes - sizeof(packet->ip))) {
 	    	DEBUG(LOG_INFO, "unrelated/bogus packet");
 	    	return -2;
 	}
 
 	/* check IP checksum */
-	check = packet.ip.check;
-	packet.ip.check = 0;
-	if (check != checksum(&(packet.ip), sizeof(packet.ip))) {
+	check = packet->ip.check;
+	packet->ip.check = 0;
+	if (check != checksum(&(packet->ip), sizeof(packet->ip))) {
 		DEBUG(LOG_INFO, "bad IP header checksum, ignoring");
 		return -1;
 	}
 	
-	/* verify the UDP checksum by replacing the header with a psuedo header */
-	source = packet.ip.saddr;
-	dest = packet.ip.daddr;
-	check = packet.udp.check;
-	packet.udp.check = 0;
-	memset(&packet.ip, 0, sizeof(packet.ip));
-
-	packet.ip.protocol = IPPROTO_UDP;
-	packet.ip.saddr = source;
-	packet.ip.daddr = dest;
-	packet.ip.tot_len = packet.udp.len; /* cheat on the psuedo-header */
-	if (check && check != checksum(&packet, bytes)) {
+	/* verify the UDP checksum */
+	check = packet->udp.check;
+	packet->udp.check = 0;
+	if (check && check != udp_checksum(packet, bytes)) {
 		DEBUG(LOG_ERR, "packet with bad UDP checksum received, ignoring");
 		return -2;
 	}
 	
-	memcpy(payload, &(packet.data), bytes - (sizeof(packet.ip) + sizeof(packet.udp)));
+	memset(payload, 0, sizeof(struct dhcpMessage));
+	memcpy(payload, &(packet->data), bytes - (sizeof(packet->ip) + sizeof(packet->udp)));
 	
 	if (ntohl(payload->cookie) != DHCP_MAGIC) {
 		LOG(LOG_ERR, "received bogus message (bad magic) -- ignoring");
 		return -2;
 	}
 	DEBUG(LOG_INFO, "oooooh!!! got some!");
-	return bytes - (sizeof(packet.ip) + sizeof(packet.udp));
+	return bytes - (sizeof(packet->ip) + sizeof(packet->udp));
+}
+
+
+#ifdef RX_RING
+/* The receive ring is RX_BLOCK_COUNT blocks that the kernel fills with
+ * frames and hands over once full or RX_BLOCK_TIMEOUT ms old. We walk a
+ * block's frames in place and give it back when done with it. */
+#define RX_BLOCK_SIZE		(1 << 15)
+#define RX_BLOCK_COUNT		8
+#define RX_FRAME_SIZE		2048
+#define RX_BLOCK_TIMEOUT	10
+
+static unsigned char *rx_ring;		/* the mapped ring, NULL if not in use */
+static unsigned int rx_block;		/* the block we are reading */
+static struct tpacket3_hdr *rx_frame;	/* next frame in it, NULL if it isn't ours yet */
+static unsigned int rx_left;		/* frames left in it */
+
+
+/* set up a receive ring on a raw socket, -1 if we have to read it instead */
+int rx_ring_attach(int fd)
+{
+	int version = TPACKET_V3;
+	struct tpacket_req3 req;
+	void *map;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RX_BLOCK_SIZE;
+	req.tp_block_nr = RX_BLOCK_COUNT;
+	req.tp_frame_size = RX_FRAME_SIZE;
+	req.tp_frame_nr = RX_BLOCK_SIZE / RX_FRAME_SIZE * RX_BLOCK_COUNT;
+	req.tp_retire_blk_tov = RX_BLOCK_TIMEOUT;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+	    setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		LOG(LOG_INFO, "couldn't set up a receive ring (%s), reading the raw socket",
+			strerror(errno));
+		return -1;
+	}
+
+	map = mmap(NULL, RX_BLOCK_SIZE * RX_BLOCK_COUNT, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		LOG(LOG_INFO, "couldn't map the receive ring (%s), reading the raw socket",
+			strerror(errno));
+		/* an unmapped ring would swallow every frame, so take it down again */
+		memset(&req, 0, sizeof(req));
+		setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		return -1;
+	}
+
+	rx_ring = map;
+	rx_block = 0;
+	rx_frame = NULL;
+	rx_left = 0;
+	return 0;
+}
+
+
+/* unmap the receive ring, before its socket is closed */
+void rx_ring_release(void)
+{
+	if (rx_ring) {
+		munmap(rx_ring, RX_BLOCK_SIZE * RX_BLOCK_COUNT);
+		rx_ring = NULL;
+	}
+}
+
+
+/* return the next DHCP packet on the ring, -2 once it has none ready */
+static int get_ring_packet(struct dhcpMessage *payload)
+{
+	struct tpacket_block_desc *block;
+	struct tpacket3_hdr *frame;
+	int len;
+
+	for (;;) {
+		block = (struct tpacket_block_desc *) (rx_ring + rx_block * RX_BLOCK_SIZE);
+		if (!rx_frame) {
+			if (!(block->hdr.bh1.block_status & TP_STATUS_USER))
+				return -2;
+			rx_frame = (struct tpacket3_hdr *) ((char *) block + block->hdr.bh1.offset_to_first_pkt);
+			rx_left = block->hdr.bh1.num_pkts;
+		}
+
+		/* unrelated traffic is skipped here, without being copied */
+		while (rx_left) {
+			frame = rx_frame;
+			rx_frame = (struct tpacket3_hdr *) ((char *) frame + frame->tp_next_offset);
+			rx_left--;
+			len = check_raw_packet((struct udp_dhcp_packet *) ((char *) frame + frame->tp_net),
+					       frame->tp_snaplen, payload);
+			if (len >= 0) return len;
+		}
+
+		/* done with this block, give it back */
+		block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		rx_frame = NULL;
+		rx_block = (rx_block + 1) % RX_BLOCK_COUNT;
+	}
+}
+#endif
+
+
+/* return -1 on errors that are fatal for the socket, -2 for those that aren't */
+int get_raw_packet(struct dhcpMessage *payload, int fd)
+{
+	int bytes;
+	struct udp_dhcp_packet packet;
+
+#ifdef RX_RING
+	if (rx_ring) return get_ring_packet(payload);
+#endif
+
+	memset(&packet, 0, sizeof(struct udp_dhcp_packet));
+	bytes = read(fd, &packet, sizeof(struct udp_dhcp_packet));
+	if (bytes < 0) {
+		DEBUG(LOG_INFO, "couldn't read on raw listening socket -- ignoring");
+		usleep(500000); /* possible down interface, looping condition */
+		return -1;
+	}
 	
+	return check_raw_packet(&packet, bytes, payload);
 }
 
@@ -8,5 +8,9 @@ int send_renew(unsigned long xid, unsigned long server, unsigned long ciaddr);
 int send_renew(unsigned long xid, unsigned long server, unsigned long ciaddr);
 int send_release(unsigned long server, unsigned long ciaddr);
 int get_raw_packet(struct dhcpMessage *payload, int fd);
+#ifdef RX_RING
+int rx_ring_attach(int fd);
+void rx_ring_release(void);
+#endif
 
 #endif
@@ -107,6 +107,9 @@ static void change_mode(int new_mode)
 {
 	DEBUG(LOG_INFO, "entering %s listen mode",
 		new_mode ? (new_mode == 1 ? "kernel" : "raw") : "none");
+#ifdef RX_RING
+	rx_ring_release();
+#endif
 	close(fd);
 	fd = -1;
 	listen_mode = new_mode;
@@ -334,11 +337,14 @@ int main(int argc, char *argv[])
 			if (listen_mode == LISTEN_KERNEL)
 				fd = listen_socket(INADDR_ANY, CLIENT_PORT, client_config.interface);
 			else
-				fd = raw_socket(client_config.ifindex);
+				fd = raw_socket(client_config.ifindex, client_config.arp);
 			if (fd < 0) {
 				LOG(LOG_ERR, "FATAL: couldn't listen on socket, %s", strerror(errno));
 				exit_client(0);
 			}
+#ifdef RX_RING
+			if (listen_mode == LISTEN_RAW) rx_ring_attach(fd);
+#endif
 		}
 		if (fd >= 0) FD_SET(fd, &rfds);
 		FD_SET(signal_pipe[0], &rfds);		
@@ -443,7 +449,7 @@ int main(int argc, char *argv[])
 			/* a packet is ready, read it */
 			
 			if (listen_mode == LISTEN_KERNEL)
-				len = get_packet(&packet, fd);
+				len = get_packet(&packet, NULL, fd);
 			else len = get_raw_packet(&packet, fd);
 			
 			if (len == -1 && errno != EINTR) {
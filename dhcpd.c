@@ -38,6 +38,9 @@
 #include <sys/ioctl.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 
 #include "debug.h"
 #include "dhcpd.h"
@@ -49,28 +52,345 @@
 #include "packet.h"
 #include "serverpacket.h"
 #include "pidfile.h"
+#include "static_leases.h"
 
 
 /* globals */
 struct dhcpOfferedAddr *leases;
 struct server_config_t server_config;
-static int signal_pipe[2];
+struct server_stats_t server_stats;
+
+/* everything the server waits on is an fd in one epoll set, each with
+ * the handler to call when it becomes readable */
+struct event {
+	void (*handle)(void);
+};
+
+static int epoll_fd = -1;
+static int server_socket = -1;
+static int signal_fd = -1;	/* SIGUSR1, SIGTERM and SIGCHLD */
+static int save_timer = -1;	/* every auto_time */
+static int probe_timer = -1;	/* end of the next ARP probe window */
+static int probe_armed;
+static struct event server_event, relay_event, arp_event, signal_event, save_event, probe_event;
 
 /* Exit and cleanup */
 static void exit_server(int retval)
 {
+	finish_save(1);
 	pidfile_delete(server_config.pidfile);
 	CLOSE_LOG();
 	exit(retval);
 }
 
 
-/* Signal handler */
-static void signal_handler(int sig)
+/* Log the counters kept in server_stats */
+static void log_stats(void)
+{
+	unsigned long probes = server_stats.arp_cache_hits + server_stats.arp_cache_misses;
+
+	LOG(LOG_INFO, "%u lease slots of at most %lu", lease_slots, server_config.max_leases);
+	LOG(LOG_INFO, "ARP cache: %lu hits, %lu misses (%lu%% hit rate)",
+		server_stats.arp_cache_hits, server_stats.arp_cache_misses,
+		probes ? server_stats.arp_cache_hits * 100 / probes : 0);
+	LOG(LOG_INFO, "%lu replies sent, %lu send errors", server_stats.tx_packets, server_stats.tx_errors);
+	LOG(LOG_INFO, "%lu packets received in %lu batches of up to %lu", server_stats.rx_packets,
+		server_stats.rx_batches, server_config.batch_size);
+	LOG(LOG_INFO, "%lu packets filtered out or dropped by the kernel",
+		socket_drops(server_socket) + socket_drops(relay_socket));
+}
+
+
+/* answer one request */
+static void handle_packet(struct dhcpMessage *packet, struct option_index *opts)
+{
+	unsigned char *state;
+	unsigned char *server_id, *requested;
+	u_int32_t server_id_align, requested_align = 0;
+	struct dhcpOfferedAddr *lease;
+	struct pool_t *pool;
+	u_int32_t static_ip;
+
+	/* 下面就是按照DHCP报文交互逻辑进行执行 */
+
+	/* 获得DHCP报文的类型 */
+	if ((state = indexed_option(packet, opts, DHCP_MESSAGE_TYPE)) == NULL) {
+		DEBUG(LOG_ERR, "couldn't get option from packet, ignoring");
+		return;
+	}
+	
+	/* the pool of the subnet the client is on */
+	if (!(pool = find_pool(packet->giaddr))) {
+		DEBUG(LOG_INFO, "no pool for relay %08x, ignoring", ntohl(packet->giaddr));
+		return;
+	}
+
+	/* 通过报文源MAC查找租赁链表中是否有租IP给过此MAC的client */
+	lease = find_lease_by_chaddr(packet->chaddr);
+	static_ip = static_ip_by_chaddr(packet->chaddr);
+	/* a reservation only holds on the subnet of its address, elsewhere the
+	 * client is served like any other */
+	if (static_ip && reserved_pool(static_ip) != pool)
+		static_ip = 0;
+
+	/* 根据协议给对应的报文回复动作 */
+	switch (state[0]) {
+	case DHCPDISCOVER:	
+		DEBUG(LOG_INFO,"received DISCOVER");
+		
+		if (sendOffer(packet, opts) < 0) {
+			LOG(LOG_ERR, "send OFFER failed");
+		}
+		break;			
+ 		case DHCPREQUEST:
+		DEBUG(LOG_INFO, "received REQUEST");
+
+		requested = indexed_option(packet, opts, DHCP_REQUESTED_IP);
+		server_id = indexed_option(packet, opts, DHCP_SERVER_ID);
+
+		if (requested) memcpy(&requested_align, requested, 4);
+		if (server_id) memcpy(&server_id_align, server_id, 4);
+	
+		/* the client has an address reserved, in any state it may only have that one */
+		if (static_ip) {
+			if (server_id && server_id_align != server_config.server) {
+				/* SELECTING State, not us */
+			} else if ((requested ? requested_align : packet->ciaddr) == static_ip)
+				sendACK(packet, opts, static_ip);
+			else sendNAK(packet);
+
+		/* 客户端位于租赁链表中 */
+		} else if (lease) {
+			/* the client moved to another subnet than its lease is for. A
+			 * unicast renewal has no giaddr, so it does not tell where it is */
+			if (!server_id && (packet->giaddr || requested) &&
+			    find_pool_by_yiaddr(lease->yiaddr) != pool) {
+				DEBUG(LOG_INFO, "lease %08x is not on the client's subnet", ntohl(lease->yiaddr));
+				sendNAK(packet);
+
+			/* 有server IP值 */
+			} else if (server_id) {
+				/* SELECTING State */
+				DEBUG(LOG_INFO, "server_id = %08x", ntohl(server_id_align));
+				/* 是服务器IP 并且 请求的IP地址在租赁链表中 */
+				if (server_id_align == server_config.server && requested && 
+				    requested_align == lease->yiaddr) {
+					sendACK(packet, opts, lease->yiaddr);// ACK
+				}
+			} else {
+				/* 没有服务器IP 但有请求IP*/
+				if (requested) {
+					/* INIT-REBOOT State */
+					/* 请求IP在租赁链表中 */
+					if (lease->yiaddr == requested_align)
+						sendACK(packet, opts, lease->yiaddr);// ACK
+					else sendNAK(packet); //NAK
+				} else {
+					/* RENEWING or REBINDING State */
+					if (lease->yiaddr == packet->ciaddr)
+						sendACK(packet, opts, lease->yiaddr);
+					else {
+						/* don't know what to do!!!! */
+						sendNAK(packet);
+					}
+				}						
+			}
+		
+		/* what to do if we have no record of the client */
+		} else if (server_id) {
+			/* SELECTING State */
+			/* 发给其他服务器的，不处理 */
+		} else if (requested) {
+			/* INIT-REBOOT State */
+			if ((lease = find_lease_by_yiaddr(requested_align))) {
+				if (lease_expired(lease)) {
+					/* probably best if we drop this lease */
+					lease_set_chaddr(lease, blank_chaddr);
+				/* make some contention for this address */
+				} else sendNAK(packet);
+			} else if (find_pool_by_yiaddr(requested_align) != pool ||
+				   static_ip_reserved(requested_align)) {
+				sendNAK(packet);
+			} /* else remain silent */
+
+		} else {
+			 /* RENEWING or REBINDING State */
+		}
+		break;
+	case DHCPDECLINE:
+		DEBUG(LOG_INFO,"received DECLINE");
+		if (lease) {
+			lease_set_chaddr(lease, blank_chaddr);
+			lease_set_expires(lease, time(0) + server_config.decline_time);
+		}			
+		break;
+	case DHCPRELEASE:
+		DEBUG(LOG_INFO,"received RELEASE");
+		if (lease) lease_set_expires(lease, time(0));
+		break;
+	case DHCPINFORM:
+		DEBUG(LOG_INFO,"received INFORM");
+		send_inform(packet);
+		break;	
+	default:
+		LOG(LOG_WARNING, "unsupported DHCP message (%02x) -- ignoring", state[0]);
+	}
+}
+
+
+/* watch fd, handle() is called each time it has something to read */
+static int add_event(struct event *event, int fd, void (*handle)(void))
+{
+	struct epoll_event ev;
+
+	event->handle = handle;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = event;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		LOG(LOG_ERR, "Could not watch fd %d: %s", fd, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+static void read_server_socket(void);
+
+/* open the listen socket, a broken one is closed and opened again by read_requests() */
+static void open_server_socket(void)
 {
-	if (send(signal_pipe[1], &sig, sizeof(sig), MSG_DONTWAIT) < 0) {
-		LOG(LOG_ERR, "Could not send signal: %s", 
-			strerror(errno));
+	if ((server_socket = listen_socket(INADDR_ANY, SERVER_PORT, server_config.interface)) < 0) {
+		LOG(LOG_ERR, "FATAL: couldn't create server socket, %s", strerror(errno));
+		exit_server(0);
+	}
+	attach_server_filter(server_socket);
+	if (add_event(&server_event, server_socket, read_server_socket) < 0)
+		exit_server(0);
+}
+
+
+/* read a batch of requests off fd and answer them */
+static void read_requests(int fd)
+{
+	static struct dhcpMessage packets[MAX_BATCH_SIZE];
+	static struct option_index opts[MAX_BATCH_SIZE];
+	int count, i;
+
+	if ((count = get_packets(packets, opts, server_config.batch_size, fd)) < 0) {
+		if (errno != EINTR && fd == server_socket) {
+			DEBUG(LOG_INFO, "error on read, %s, reopening socket", strerror(errno));
+			close(server_socket);
+			open_server_socket();
+		}
+		return;
+	}
+	if (count) {
+		server_stats.rx_packets += count;
+		server_stats.rx_batches++;
+	}
+	for (i = 0; i < count; i++)
+		handle_packet(&packets[i], &opts[i]);
+}
+
+
+static void read_server_socket(void)
+{
+	read_requests(server_socket);
+}
+
+
+/* requests unicast to our address come in on the relay socket */
+static void read_relay_socket(void)
+{
+	read_requests(relay_socket);
+}
+
+
+/* answers to our ARP probes */
+static void read_arp_replies(void)
+{
+	u_int32_t addr;
+	int retval;
+
+	while ((retval = get_arp_reply(server_config.arp, &addr)) >= 0)
+		if (retval) probe_conflict(addr);
+}
+
+
+/* (re)start the auto_time period */
+static void set_save_timer(void)
+{
+	struct itimerspec its;
+
+	if (save_timer < 0) return;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = its.it_interval.tv_sec = server_config.auto_time;
+	timerfd_settime(save_timer, 0, &its, NULL);
+}
+
+
+static void save_timeout(void)
+{
+	u_int64_t expired;
+
+	if (read(save_timer, &expired, sizeof(expired)) < 0)
+		return;
+	save_leases();
+	compact_leases();
+}
+
+
+/* wake up in time to send the OFFERs whose ARP probes are done */
+static void set_probe_timer(void)
+{
+	struct itimerspec its;
+	struct timeval tv;
+	int probing = probe_timeout(&tv);
+
+	if (!probing && !probe_armed) return;
+	memset(&its, 0, sizeof(its));
+	if (probing) {
+		/* a zero it_value would disarm it */
+		its.it_value.tv_sec = tv.tv_sec;
+		its.it_value.tv_nsec = tv.tv_usec * 1000 + 1;
+	}
+	timerfd_settime(probe_timer, 0, &its, NULL);
+	probe_armed = probing;
+}
+
+
+/* the probes themselves are finished after every wakeup, this only clears the timer */
+static void probe_timeout_event(void)
+{
+	u_int64_t expired;
+
+	if (read(probe_timer, &expired, sizeof(expired)) < 0)
+		DEBUG(LOG_INFO, "error reading probe timer, %s", strerror(errno));
+}
+
+
+static void read_signal(void)
+{
+	struct signalfd_siginfo info;
+
+	if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
+		return; /* probably just EINTR */
+	switch (info.ssi_signo) {
+	case SIGUSR1:
+		LOG(LOG_INFO, "Received a SIGUSR1");
+		save_leases();
+		log_stats();
+		/* why not just reset the timeout, eh */
+		set_save_timer();
+		break;
+	case SIGTERM:
+		LOG(LOG_INFO, "Received a SIGTERM");
+		exit_server(0);
+		break;
+	case SIGCHLD:
+		finish_save(0);
+		break;
 	}
 }
 
@@ -81,20 +401,11 @@ int udhcpd_main(int argc, char *argv[])
 int main(int argc, char *argv[])
 #endif
 {	
-	fd_set rfds;
-	struct timeval tv;
-	int server_socket = -1;
-	int bytes, retval;
-	struct dhcpMessage packet;
-	unsigned char *state;
-	unsigned char *server_id, *requested;
-	u_int32_t server_id_align, requested_align;
-	unsigned long timeout_end;
+	struct epoll_event ready[MAX_EVENTS];
 	struct option_set *option;
-	struct dhcpOfferedAddr *lease;
+	sigset_t signals;
 	int pid_fd;
-	int max_sock;
-	int sig;
+	int count, i;
 	
 	OPEN_LOG("udhcpd");
 	LOG(LOG_INFO, "udhcp server (v%s) started", VERSION);
@@ -106,6 +417,13 @@ int main(int argc, char *argv[])
 		read_config(DHCPD_CONF_FILE);/* use default config file */
 	else read_config(argv[1]);/* use designated config file */
 
+	if (!server_config.batch_size) server_config.batch_size = 1;
+	else if (server_config.batch_size > MAX_BATCH_SIZE) server_config.batch_size = MAX_BATCH_SIZE;
+
+	/* the reservations have to be in before the pools are set up */
+	if (server_config.static_file)
+		read_static_leases(server_config.static_file);
+
 	/* record pid number */
 	pid_fd = pidfile_acquire(server_config.pidfile);
 	pidfile_write_release(pid_fd);
@@ -119,10 +437,10 @@ int main(int argc, char *argv[])
 	else 
 		/* 配置文件中没有指定租赁时间就使用默认值LEASE_TIME(10天) */
 		server_config.lease = LEASE_TIME;
-	/* max_leases默认是254条 */
-	leases = malloc(sizeof(struct dhcpOfferedAddr) * server_config.max_leases);
-	memset(leases, 0, sizeof(struct dhcpOfferedAddr) * server_config.max_leases);
+	/* max_leases默认是0,即地址池的大小 */
+	init_leases();
 	read_leases(server_config.lease_file);
+	read_journal();
 
 	/*
 	  通过interface获得ip地址、mac地址(arp)、interface index三个量
@@ -132,6 +450,14 @@ int main(int argc, char *argv[])
 			   &server_config.server, server_config.arp) < 0)
 		exit_server(1);//异常退出
 
+	/* ARP probes share one socket, without it sendOffer() falls back to blocking ones */
+	if (open_arp_socket(server_config.ifindex, server_config.arp) < 0)
+		LOG(LOG_WARNING, "falling back to blocking ARP probes");
+
+	/* without the relay socket, each reply to a relay opens a socket of its own */
+	if (open_relay_socket() < 0)
+		LOG(LOG_WARNING, "replies to relays are sent one socket at a time");
+
 #ifndef DEBUGGING
 	pid_fd = pidfile_acquire(server_config.pidfile); /* hold lock during fork. */
 	/* 调用daemon使函数运行于后台 */
@@ -142,196 +468,49 @@ int main(int argc, char *argv[])
 	pidfile_write_release(pid_fd);
 #endif
 	/*
-	  socketpair创建一对套接字，可实现全双工通信
-			signal_pipe[1] --> write
-			signal_pipe[0] --> read
-	*/
-	socketpair(AF_UNIX, SOCK_STREAM, 0, signal_pipe);
-
-	/*
-	  监听两种信号，收到后通过signal_pipe[1]将信号对应的信号数值发送给signal_pipe[0]
+	  监听三种信号,它们被阻塞,改由signal_fd读出
 	  SIGUSR1:用户自定义信号？数值：16
 	  SIGTERM:后台进程被结束(kill掉)，数值:15
+	  SIGCHLD: the child writing the lease file (fork_save) is done
 	*/
-	signal(SIGUSR1, signal_handler);
-	signal(SIGTERM, signal_handler);
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &signals, NULL);
+
+	if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+	    (signal_fd = signalfd(-1, &signals, SFD_CLOEXEC)) < 0 ||
+	    (probe_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0 ||
+	    (server_config.auto_time && (save_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0)) {
+		LOG(LOG_ERR, "FATAL: couldn't set up the event loop, %s", strerror(errno));
+		exit_server(1);
+	}
+	if (add_event(&signal_event, signal_fd, read_signal) < 0 ||
+	    add_event(&probe_event, probe_timer, probe_timeout_event) < 0 ||
+	    (save_timer >= 0 && add_event(&save_event, save_timer, save_timeout) < 0) ||
+	    (arp_socket >= 0 && add_event(&arp_event, arp_socket, read_arp_replies) < 0) ||
+	    (relay_socket >= 0 && add_event(&relay_event, relay_socket, read_relay_socket) < 0))
+		exit_server(1);
+	open_server_socket();
 
 	/* server_config.auto_time 是指定更新lease_file文件的周期 */
-	timeout_end = time(0) + server_config.auto_time;
+	set_save_timer();
 	while(1) { /* loop until universe collapses */
 
-		//拿到一个套接字
-		if (server_socket < 0)
-			if ((server_socket = listen_socket(INADDR_ANY, SERVER_PORT, server_config.interface)) < 0) {
-				LOG(LOG_ERR, "FATAL: couldn't create server socket, %s", strerror(errno));
-				exit_server(0);
-			}			
-		/*
-			select监控server_socket & signal_pipe[0] 的可读状态
-			select非阻塞,可监控多个文件描述符状态,以下是使用select的几个要点
-			1:FD_SET将某个fd记录在位图rfds中(rfds若是一个字节长度最多只能监听8个fd)，select调用先清空rfds位图，在
-			  某个fd状态就绪后将它原先的位置1，之后FD_ISSET检测此fd对应的位图是否为一即准备就绪。
-			2:参数5是struct timeval *类型，表示阻塞时间
-		      NULL ---> 完全阻塞方式，一定要等到监听的fd有就绪的才返回(变成了可以监听多个fd的阻塞函数比如accept,
-			 	        recv,等)
-			   0   ---> 不阻塞，select函数执行后立即返回
-			  >0   ---> 半阻塞,在timeout内阻塞，有状态改变即返回，timeout时间到也要返回
-			注:select每次都会清空此参数的值，所以必须每次执行select前都要设置一下此参数值否则很可能意外变为不阻
-			  塞的select.
-		*/
-		FD_ZERO(&rfds);
-		FD_SET(server_socket, &rfds);
-		FD_SET(signal_pipe[0], &rfds);
-		if (server_config.auto_time) {
-			tv.tv_sec = timeout_end - time(0);
-			tv.tv_usec = 0;
-		}
-		if (!server_config.auto_time || tv.tv_sec > 0) {
-			max_sock = server_socket > signal_pipe[0] ? server_socket : signal_pipe[0];
-			retval = select(max_sock + 1, &rfds, NULL, NULL, 
-					server_config.auto_time ? &tv : NULL);
-		} else retval = 0; /* If we already timed out, fall through */
-
-		/*
-			retval == 0 select timeout,此时间内没有监听到准备好的fd
-		*/
-		if (retval == 0) {
-			write_leases();
-			timeout_end = time(0) + server_config.auto_time;
-			continue;
-		} else if (retval < 0 && errno != EINTR) {
-			DEBUG(LOG_INFO, "error on select");
-			continue;
-		}
-		
-		/* 先处理信号的输入 */
-		if (FD_ISSET(signal_pipe[0], &rfds)) {
-			if (read(signal_pipe[0], &sig, sizeof(sig)) < 0)
-				continue; /* probably just EINTR */
-			switch (sig) {
-			case SIGUSR1:
-				LOG(LOG_INFO, "Received a SIGUSR1");
-				write_leases();
-				/* why not just reset the timeout, eh */
-				timeout_end = time(0) + server_config.auto_time;
-				continue;
-			case SIGTERM:
-				LOG(LOG_INFO, "Received a SIGTERM");
-				exit_server(0);
-			}
-		}
-
-		/* 走到这里说明server_socket已准备就绪 */
-		if ((bytes = get_packet(&packet, server_socket)) < 0) { /* this waits for a packet - idle */
-			if (bytes == -1 && errno != EINTR) {
-				DEBUG(LOG_INFO, "error on read, %s, reopening socket", strerror(errno));
-				close(server_socket);
-				server_socket = -1;
-			}
-			continue;
-		}
-
-		/* 下面就是按照DHCP报文交互逻辑进行执行 */
+		/* the replies made since we last looked go out together */
+		flush_replies();
+		set_probe_timer();
 
-		/* 获得DHCP报文的类型 */
-		if ((state = get_option(&packet, DHCP_MESSAGE_TYPE)) == NULL) {
-			DEBUG(LOG_ERR, "couldn't get option from packet, ignoring");
+		if ((count = epoll_wait(epoll_fd, ready, MAX_EVENTS, -1)) < 0) {
+			if (errno != EINTR) DEBUG(LOG_INFO, "error on epoll_wait");
 			continue;
 		}
-		
-		/* ADDME: look for a static lease */
-		/* 通过报文源MAC查找租赁链表中是否有租IP给过此MAC的client */
-		lease = find_lease_by_chaddr(packet.chaddr);
-
-		/* 根据协议给对应的报文回复动作 */
-		switch (state[0]) {
-		case DHCPDISCOVER:	
-			DEBUG(LOG_INFO,"received DISCOVER");
-			
-			if (sendOffer(&packet) < 0) {
-				LOG(LOG_ERR, "send OFFER failed");
-			}
-			break;			
- 		case DHCPREQUEST:
-			DEBUG(LOG_INFO, "received REQUEST");
 
-			requested = get_option(&packet, DHCP_REQUESTED_IP);
-			server_id = get_option(&packet, DHCP_SERVER_ID);
-
-			if (requested) memcpy(&requested_align, requested, 4);
-			if (server_id) memcpy(&server_id_align, server_id, 4);
-		
-			/* 客户端位于租赁链表中 */
-			if (lease) { /*ADDME: or static lease */
-				/* 有server IP值 */
-				if (server_id) {
-					/* SELECTING State */
-					DEBUG(LOG_INFO, "server_id = %08x", ntohl(server_id_align));
-					/* 是服务器IP 并且 请求的IP地址在租赁链表中 */
-					if (server_id_align == server_config.server && requested && 
-					    requested_align == lease->yiaddr) {
-						sendACK(&packet, lease->yiaddr);// ACK
-					}
-				} else {
-					/* 没有服务器IP 但有请求IP*/
-					if (requested) {
-						/* INIT-REBOOT State */
-						/* 请求IP在租赁链表中 */
-						if (lease->yiaddr == requested_align)
-							sendACK(&packet, lease->yiaddr);// ACK
-						else sendNAK(&packet); //NAK
-					} else {
-						/* RENEWING or REBINDING State */
-						if (lease->yiaddr == packet.ciaddr)
-							sendACK(&packet, lease->yiaddr);
-						else {
-							/* don't know what to do!!!! */
-							sendNAK(&packet);
-						}
-					}						
-				}
-			
-			/* what to do if we have no record of the client */
-			} else if (server_id) {
-				/* SELECTING State */
-				/* 发给其他服务器的，不处理 */
-			} else if (requested) {
-				/* INIT-REBOOT State */
-				if ((lease = find_lease_by_yiaddr(requested_align))) {
-					if (lease_expired(lease)) {
-						/* probably best if we drop this lease */
-						memset(lease->chaddr, 0, 16);
-					/* make some contention for this address */
-					} else sendNAK(&packet);
-				} else if (requested_align < server_config.start || 
-					   requested_align > server_config.end) {
-					sendNAK(&packet);
-				} /* else remain silent */
-
-			} else {
-				 /* RENEWING or REBINDING State */
-			}
-			break;
-		case DHCPDECLINE:
-			DEBUG(LOG_INFO,"received DECLINE");
-			if (lease) {
-				memset(lease->chaddr, 0, 16);
-				lease->expires = time(0) + server_config.decline_time;
-			}			
-			break;
-		case DHCPRELEASE:
-			DEBUG(LOG_INFO,"received RELEASE");
-			if (lease) lease->expires = time(0);
-			break;
-		case DHCPINFORM:
-			DEBUG(LOG_INFO,"received INFORM");
-			send_inform(&packet);
-			break;	
-		default:
-			LOG(LOG_WARNING, "unsupported DHCP message (%02x) -- ignoring", state[0]);
-		}
+		finish_probes();
+		for (i = 0; i < count; i++)
+			((struct event *) ready[i].data.ptr)->handle();
 	}
 
 	return 0;
 }
-
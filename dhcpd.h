@@ -18,6 +18,27 @@
 /* where to find the DHCP server configuration file */
 #define DHCPD_CONF_FILE         "/etc/udhcpd.conf"
 
+/* how many OFFERs can wait for the ARP probe of their address at once */
+#define MAX_ARP_PROBES		32
+
+/* seconds an address is ARP probed before it is offered */
+#define ARP_PROBE_TIME		2
+
+/* number of recent ARP probe results remembered (arp_cache_ttl sets for how long) */
+#define ARP_CACHE_SIZE		256
+
+/* the lease table starts this big and never shrinks below it */
+#define MIN_LEASE_SLOTS		64
+
+/* how many replies are queued to be sent with one sendmmsg() */
+#define REPLY_QUEUE_SIZE	64
+
+/* the most packets batch_size lets the server read with one recvmmsg() */
+#define MAX_BATCH_SIZE		64
+
+/* the most ready sockets and timers handled per wakeup of the event loop */
+#define MAX_EVENTS		16
+
 /*****************************************************************/
 /* Do not modify below here unless you know what you are doing!! */
 /*****************************************************************/
@@ -92,16 +113,39 @@
 #define OPT_LEN 1
 #define OPT_DATA 2
 
+/* room for the config file options in a reply, after the message type,
+ * server id and lease time options and before the end option */
+#define OPTION_BLOB_MAX		(308 - 3 - 6 - 6 - 1)
+
 struct option_set {
 	unsigned char *data;
 	struct option_set *next;
 };
 
+/* a range of addresses handed out to one subnet */
+struct pool_t {
+	u_int32_t start;		/* first address, network order */
+	u_int32_t end;			/* last address, network order */
+	u_int32_t mask;			/* netmask of the relayed subnet, network order */
+	u_int32_t base;			/* offset of start into the pool index */
+	u_int32_t size;			/* number of addresses */
+	u_int32_t cursor;		/* offset find_address() looks at first */
+	struct option_set *options;	/* options sent instead of the global ones */
+	unsigned char *option_blob;	/* options, then the global ones they do not
+					 * override, as they go into a reply */
+	int option_blob_len;
+};
+
 struct server_config_t {
 	u_int32_t server;		/* Our IP, in network order */
 	u_int32_t start;		/* Start address of leases, network order */
 	u_int32_t end;			/* End of leases, network order */
+	struct pool_t *pools;		/* pools[0] is start - end for clients on our
+					 * interface, then the relayed pools by address */
+	unsigned long pool_count;
 	struct option_set *options;	/* List of DHCP options loaded from the config file */
+	unsigned char *option_blob;	/* options but the lease time, as they go into a reply */
+	int option_blob_len;
 	char *interface;		/* The name of the interface to use */
 	int ifindex;			/* Index number of the interface to use */
 	unsigned char arp[6];		/* Our arp address */
@@ -111,20 +155,34 @@ struct server_config_t {
 			 		 * as the time the lease expires */
 	unsigned long auto_time; 	/* how long should udhcpd wait before writing a config file.
 					 * if this is zero, it will only write one on SIGUSR1 */
+	char fork_save;			/* write the lease file from a child process */
+	unsigned long batch_size;	/* most requests read at once */
 	unsigned long decline_time; 	/* how long an address is reserved if a client returns a
 				    	 * decline message */
 	unsigned long conflict_time; 	/* how long an arp conflict offender is leased for */
 	unsigned long offer_time; 	/* how long an offered address is reserved */
 	unsigned long min_lease; 	/* minimum lease a client can request*/
+	unsigned long arp_cache_ttl;	/* how long an ARP probe result is trusted */
 	char *lease_file;
 	char *pidfile;
 	char *notify_file;		/* What to run whenever leases are written */
+	char *static_file;		/* reserved addresses, see static_leases.c */
 	u_int32_t siaddr;		/* next server bootp option */
 	char *sname;			/* bootp server name */
 	char *boot_file;		/* bootp boot file option */
 };	
 
+struct server_stats_t {
+	unsigned long arp_cache_hits;	/* probes answered from the ARP cache */
+	unsigned long arp_cache_misses;	/* probes that went out on the wire */
+	unsigned long tx_packets;	/* replies sent */
+	unsigned long tx_errors;	/* replies that could not be sent */
+	unsigned long rx_packets;	/* requests read */
+	unsigned long rx_batches;	/* reads they took */
+};
+
 extern struct server_config_t server_config;
+extern struct server_stats_t server_stats;
 extern struct dhcpOfferedAddr *leases;
 		
 
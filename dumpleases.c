@@ -18,16 +18,52 @@
 #include <time.h>
 
 #include "libbb_udhcp.h"
+#include "leases.h"
 
 #define REMAINING 0
 #define ABSOLUTE 1
 
+/* the records of lease files from before the header */
 struct lease_t {
 	unsigned char chaddr[16];
 	u_int32_t yiaddr;
 	u_int32_t expires;
 };
 
+
+/* print one lease, expires is the time remaining or the time it expires at, as mode says */
+static void print_lease(unsigned char *chaddr, u_int32_t yiaddr, long expires, int mode)
+{
+	struct in_addr addr;
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		printf("%02x", chaddr[i]);
+		if (i != 5) printf(":");
+	}
+	addr.s_addr = yiaddr;
+	printf(" %-15s", inet_ntoa(addr));
+	printf(" ");
+	if (mode == REMAINING) {
+		if (!expires) printf("expired\n");
+		else {
+			if (expires > 60*60*24) {
+				printf("%ld days, ", expires / (60*60*24));
+				expires %= 60*60*24;
+			}
+			if (expires > 60*60) {
+				printf("%ld hours, ", expires / (60*60));
+				expires %= 60*60;
+			}
+			if (expires > 60) {
+				printf("%ld minutes, ", expires / 60);
+				expires %= 60;
+			}
+			printf("%ld seconds\n", expires);
+		}
+	} else printf("%s", ctime(&expires));
+}
+
 #ifdef BB_VER
 int dumpleases_main(int argc, char *argv[])
 #else
@@ -35,11 +71,13 @@ int main(int argc, char *argv[])
 #endif
 {
 	FILE *fp;
-	int i, c, mode = REMAINING;
-	long expires;
+	int c, mode = REMAINING;
+	long now = time(0);
 	char file[255] = "/var/lib/misc/udhcpd.leases";
 	struct lease_t lease;
-	struct in_addr addr;
+	struct lease_file_header header;
+	struct dhcpOfferedAddr record;
+	u_int32_t i;
 	
 	static struct option options[] = {
 		{"absolute", 0, 0, 'a'},
@@ -77,34 +115,21 @@ int main(int argc, char *argv[])
 
 	printf("Mac Address       IP-Address      Expires %s\n", mode == REMAINING ? "in" : "at");  
 	/*     "00:00:00:00:00:00 255.255.255.255 Wed Jun 30 21:49:08 1993" */
-	while (fread(&lease, sizeof(lease), 1, fp)) {
-
-		for (i = 0; i < 6; i++) {
-			printf("%02x", lease.chaddr[i]);
-			if (i != 5) printf(":");
+	if (fread(&header, sizeof(header), 1, fp) && header.magic == LEASE_FILE_MAGIC) {
+		if (header.version != LEASE_FILE_VERSION ||
+		    header.record_size != sizeof(struct dhcpOfferedAddr)) {
+			fprintf(stderr, "unknown lease file version %d\n", header.version);
+			fclose(fp);
+			return 0;
 		}
-		addr.s_addr = lease.yiaddr;
-		printf(" %-15s", inet_ntoa(addr));
-		expires = ntohl(lease.expires);
-		printf(" ");
-		if (mode == REMAINING) {
-			if (!expires) printf("expired\n");
-			else {
-				if (expires > 60*60*24) {
-					printf("%ld days, ", expires / (60*60*24));
-					expires %= 60*60*24;
-				}
-				if (expires > 60*60) {
-					printf("%ld hours, ", expires / (60*60));
-					expires %= 60*60;
-				}
-				if (expires > 60) {
-					printf("%ld minutes, ", expires / 60);
-					expires %= 60;
-				}
-				printf("%ld seconds\n", expires);
-			}
-		} else printf("%s", ctime(&expires));
+		/* the records always hold the time they expire at */
+		for (i = 0; i < header.count && fread(&record, sizeof(record), 1, fp); i++)
+			print_lease(record.chaddr, record.yiaddr, mode == ABSOLUTE ? (long) record.expires :
+				    (long) record.expires > now ? (long) record.expires - now : 0, mode);
+	} else {
+		rewind(fp);
+		while (fread(&lease, sizeof(lease), 1, fp))
+			print_lease(lease.chaddr, lease.yiaddr, ntohl(lease.expires), mode);
 	}
 	fclose(fp);
 	
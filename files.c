@@ -11,12 +11,21 @@
 #include <time.h>
 #include <ctype.h>
 #include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <signal.h>
 
 #include "debug.h"
 #include "dhcpd.h"
 #include "files.h"
 #include "options.h"
 #include "leases.h"
+#include "static_leases.h"
 
 
 /* 将字符串格式的ip地址转换为u_int32_t保存在地址arg中 */
@@ -160,6 +169,66 @@ static int read_opt(char *line, void *arg)
 	return retval;
 }
 
+/* read a relayed pool: its first and last address and the netmask of its subnet */
+static int read_pool(char *line, void *arg)
+{
+	struct pool_t **pools = arg, *pool;
+	char *start, *end, *mask;
+
+	if (!(start = strtok(line, " \t")) || !(end = strtok(NULL, " \t")) ||
+	    !(mask = strtok(NULL, " \t")))
+		return 0;
+	if (!(pool = xrealloc(*pools, sizeof(struct pool_t) * (server_config.pool_count + 1))))
+		return 0;
+	*pools = pool;
+	pool += server_config.pool_count;
+	memset(pool, 0, sizeof(struct pool_t));
+	if (!read_ip(start, &(pool->start)) || !read_ip(end, &(pool->end)) ||
+	    !read_ip(mask, &(pool->mask)) || ntohl(pool->start) > ntohl(pool->end) ||
+	    (pool->start & pool->mask) != (pool->end & pool->mask))
+		return 0;
+	server_config.pool_count++;
+	return 1;
+}
+
+/* read a dhcp option for the last pool read */
+static int read_pool_opt(char *line, void *arg)
+{
+	struct pool_t **pools = arg;
+
+	if (!server_config.pool_count) return 0;
+	return read_opt(line, &((*pools)[server_config.pool_count - 1].options));
+}
+
+/* lay out the options sent in every reply once, as they go into the packet.
+ * Those in first come before the ones in rest they do not override, the
+ * lease time is left out as it is worked out for each client */
+static unsigned char *compile_options(struct option_set *first, struct option_set *rest, int *len)
+{
+	unsigned char blob[OPTION_BLOB_MAX], *data;
+	struct option_set *list, *curr;
+	int pass, size = 0;
+
+	for (pass = 0, list = first; pass < 2; pass++, list = rest)
+		for (curr = list; curr; curr = curr->next) {
+			if (curr->data[OPT_CODE] == DHCP_LEASE_TIME ||
+			    (pass && find_option(first, curr->data[OPT_CODE])))
+				continue;
+			if (size + curr->data[OPT_LEN] + 2 > OPTION_BLOB_MAX) {
+				LOG(LOG_ERR, "Option 0x%02x did not fit into the packet!", curr->data[OPT_CODE]);
+				continue;
+			}
+			memcpy(blob + size, curr->data, curr->data[OPT_LEN] + 2);
+			size += curr->data[OPT_LEN] + 2;
+		}
+
+	if ((data = xmalloc(size + 1))) {
+		memcpy(data, blob, size);
+		*len = size;
+	} else *len = 0;
+	return data;
+}
+
 //struct config_keyword 将key、处理方法、要保存的地址、默认配置四项组在一起
 static struct config_keyword keywords[] = {
 	/* keyword[14]	handler   variable address		default[20] */
@@ -168,20 +237,25 @@ static struct config_keyword keywords[] = {
 	{"interface",	read_str, &(server_config.interface),	"eth0"},
 	{"option",	read_opt, &(server_config.options),	""},
 	{"opt",		read_opt, &(server_config.options),	""},
-	{"max_leases",	read_u32, &(server_config.max_leases),	"254"},
+	{"pool",	read_pool, &(server_config.pools),	""},
+	{"pool_option",	read_pool_opt, &(server_config.pools),	""},
+	{"max_leases",	read_u32, &(server_config.max_leases),	"0"},
 	{"remaining",	read_yn,  &(server_config.remaining),	"yes"},
 	{"auto_time",	read_u32, &(server_config.auto_time),	"7200"},
 	{"decline_time",read_u32, &(server_config.decline_time),"3600"},
 	{"conflict_time",read_u32,&(server_config.conflict_time),"3600"},
 	{"offer_time",	read_u32, &(server_config.offer_time),	"60"},
 	{"min_lease",	read_u32, &(server_config.min_lease),	"60"},
+	{"arp_cache_ttl",read_u32,&(server_config.arp_cache_ttl),"30"},
+	{"fork_save",	read_yn,  &(server_config.fork_save),	"no"},
+	{"batch_size",	read_u32, &(server_config.batch_size),	"16"},
 	{"lease_file",	read_str, &(server_config.lease_file),	"/var/lib/misc/udhcpd.leases"},
 	{"pidfile",	read_str, &(server_config.pidfile),	"/var/run/udhcpd.pid"},
 	{"notify_file", read_str, &(server_config.notify_file),	""},
 	{"siaddr",	read_ip,  &(server_config.siaddr),	"0.0.0.0"},
 	{"sname",	read_str, &(server_config.sname),	""},
 	{"boot_file",	read_str, &(server_config.boot_file),	""},
-	/*ADDME: static lease */
+	{"static_file",	read_str, &(server_config.static_file),	""},
 	{"",		NULL, 	  NULL,				""}
 };
 
@@ -248,48 +322,329 @@ int read_config(char *file)
 				}
 	}
 	fclose(in);
+
+	server_config.option_blob = compile_options(server_config.options, NULL,
+						    &server_config.option_blob_len);
+	for (i = 0; i < (int) server_config.pool_count; i++)
+		if (server_config.pools[i].options)
+			server_config.pools[i].option_blob = compile_options(server_config.pools[i].options,
+				server_config.options, &server_config.pools[i].option_blob_len);
 	return 1;
 }
 
+/* a lease as stored in the journal and in lease files from before the header */
+struct lease_record {
+	u_int8_t  chaddr[16];
+	u_int32_t yiaddr;	/* network order */
+	u_int32_t expires;	/* network order */
+};
+
+/* every change to a lease is appended to the journal, the next write_leases()
+ * folds it into the lease file and empties it again. A background write works
+ * from journal_old, which is the journal up to the fork */
+static char *journal_file;
+static char *journal_old;
+static int journal_fd = -1;
+
+/* the child writing the lease file, if any */
+static pid_t save_pid;
+static int save_failed;
+
+
+/* fill in the file record of lease, with the time remaining or the time it
+ * expires at, depending on server_config.remaining */
+static void fill_record(struct lease_record *record, struct dhcpOfferedAddr *lease, time_t curr)
+{
+	unsigned long lease_time;
+
+	if (server_config.remaining) {
+		if (lease_expired(lease))//如果地址过期设置为0
+			lease_time = 0;
+		else lease_time = lease->expires - curr;
+	} else lease_time = lease->expires;
+	memset(record, 0, sizeof(struct lease_record));
+	memcpy(record->chaddr, lease->chaddr, LEASE_CHADDR_LEN);
+	record->yiaddr = lease->yiaddr;
+	record->expires = htonl(lease_time);
+}
+
+
+/* a Fletcher style running checksum of the lease file records, sum[] starts out 0 */
+static void lease_checksum(u_int32_t sum[2], struct dhcpOfferedAddr *records, u_int32_t count)
+{
+	u_int32_t *word = (u_int32_t *) records;
+	size_t n = count * sizeof(struct dhcpOfferedAddr) / 4;
+
+	while (n--) {
+		sum[0] += *word++;
+		sum[1] += sum[0];
+	}
+}
+
+
+/* run the notify_file command. Like system(), except that the server's
+ * signals are handed to it unblocked */
+static void run_notify(char *cmd)
+{
+	sigset_t mask;
+	pid_t pid;
+
+	if ((pid = fork()) < 0) {
+		LOG(LOG_ERR, "Unable to fork to run %s: %s", server_config.notify_file, strerror(errno));
+		return;
+	} else if (pid == 0) {
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+		_exit(127);
+	}
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+}
+
+
 /*
 	通过遍历struct dhcpOfferedAddr *leases指向的链表更新lease_file文件内容,
-	server_config.remaining 为真表示lease_file文件中存储的过期时间是绝对时间
-	(time(0) + expires)否则存储相对时间(expires)
+	文件中存储的是绝对过期时间,server_config.remaining 为真时读取时按文件写入时刻
+	(header.written)换算成剩余时间
+	returns -1 if the file could not be written
 */
-void write_leases(void)
+static int write_lease_file(void)
 {
 	FILE *fp;
 	unsigned int i;
-	char buf[255];
-	time_t curr = time(0);
-	unsigned long lease_time;
+	char buf[255], *tmp_file;
+	struct lease_file_header header;
+	struct dhcpOfferedAddr record;
+	u_int32_t sum[2] = {0, 0};
+	int failed;
 	
-	if (!(fp = fopen(server_config.lease_file, "w"))) {
-		LOG(LOG_ERR, "Unable to open %s for writing", server_config.lease_file);
-		return;
+	/* write a new file and rename it over the old one, so a crash or
+	 * a reader never sees half of it */
+	tmp_file = xmalloc(strlen(server_config.lease_file) + 5);
+	sprintf(tmp_file, "%s.tmp", server_config.lease_file);
+	if (!(fp = fopen(tmp_file, "w"))) {
+		LOG(LOG_ERR, "Unable to open %s for writing", tmp_file);
+		free(tmp_file);
+		return -1;
 	}
 	
-	for (i = 0; i < server_config.max_leases; i++) {
+	memset(&header, 0, sizeof(header));
+	header.magic = LEASE_FILE_MAGIC;
+	header.version = LEASE_FILE_VERSION;
+	header.record_size = sizeof(struct dhcpOfferedAddr);
+	header.written = time(0);
+	fwrite(&header, sizeof(header), 1, fp);
+	for (i = 0; i < lease_slots; i++) {
 		if (leases[i].yiaddr != 0) {
-			if (server_config.remaining) {
-				if (lease_expired(&(leases[i])))//如果地址过期设置为0
-					lease_time = 0;
-				else lease_time = leases[i].expires - curr;
-			} else lease_time = leases[i].expires;
-			lease_time = htonl(lease_time);
-			fwrite(leases[i].chaddr, 16, 1, fp);
-			fwrite(&(leases[i].yiaddr), 4, 1, fp);
-			fwrite(&lease_time, 4, 1, fp);
+			record = leases[i];
+			lease_checksum(sum, &record, 1);
+			fwrite(&record, sizeof(record), 1, fp);
+			header.count++;
 		}
 	}
-	fclose(fp);
+	header.checksum = sum[0] ^ sum[1];
+	rewind(fp);
+	fwrite(&header, sizeof(header), 1, fp);
+
+	failed = fflush(fp) || ferror(fp) || fsync(fileno(fp)) < 0;
+	if (fclose(fp) || failed || rename(tmp_file, server_config.lease_file) < 0) {
+		LOG(LOG_ERR, "Unable to write %s", server_config.lease_file);
+		unlink(tmp_file);
+		free(tmp_file);
+		return -1;
+	}
+	free(tmp_file);
 	
 	if (server_config.notify_file) {
 		sprintf(buf, "%s %s", server_config.notify_file, server_config.lease_file);
-		system(buf);
+		run_notify(buf);
+	}
+	return 0;
+}
+
+
+/* write the lease file right away */
+void write_leases(void)
+{
+	if (write_lease_file() < 0) return;
+
+	/* everything in the journal is in the lease file now */
+	if (journal_fd >= 0 && ftruncate(journal_fd, 0) < 0)
+		LOG(LOG_ERR, "Unable to truncate %s", journal_file);
+	if (journal_old) unlink(journal_old);
+	save_failed = 0;
+}
+
+
+/* write the lease file, every auto_time and on SIGUSR1. With fork_save a child
+ * writes the copy on write snapshot of the table while we go on serving, and
+ * the journal is moved aside until finish_save() hears it is done */
+void save_leases(void)
+{
+	pid_t pid;
+
+	if (save_pid > 0) {
+		DEBUG(LOG_INFO, "lease file write still running");
+		return;
+	}
+	/* after a failed background write, journal_old holds changes only the next write has */
+	if (!server_config.fork_save || save_failed) {
+		write_leases();
+		return;
 	}
+
+	if (journal_fd >= 0) {
+		if (rename(journal_file, journal_old) < 0) {
+			write_leases();
+			return;
+		}
+		close(journal_fd);
+		if ((journal_fd = open(journal_file, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644)) < 0)
+			LOG(LOG_ERR, "Unable to open %s", journal_file);
+	}
+
+	if ((pid = fork()) < 0) {
+		LOG(LOG_ERR, "Unable to fork to write leases: %s", strerror(errno));
+		write_leases();
+	} else if (pid == 0)
+		_exit(write_lease_file() < 0);
+	else save_pid = pid;
 }
 
+
+/* reap the child writing the lease file on SIGCHLD, or wait for it if block is set */
+void finish_save(int block)
+{
+	int status;
+
+	if (save_pid <= 0 || waitpid(save_pid, &status, block ? 0 : WNOHANG) != save_pid)
+		return;
+	save_pid = 0;
+	if (WIFEXITED(status) && !WEXITSTATUS(status))
+		unlink(journal_old);
+	else {
+		LOG(LOG_ERR, "background write of %s failed", server_config.lease_file);
+		save_failed = 1;
+	}
+}
+
+
+/* a lease from a file is only kept if its address is still in a pool, and
+ * leases of reserved addresses only survive for their owner */
+static int usable_lease(u_int8_t *chaddr, u_int32_t yiaddr)
+{
+	return find_pool_by_yiaddr(yiaddr) && (!static_ip_reserved(yiaddr) ||
+		static_ip_by_chaddr(chaddr) == yiaddr);
+}
+
+
+/* add a lease replayed from the journal, lease_time is the time it has left.
+ * Returns 1 if it was added, 0 if it was skipped and -1 if the table is full */
+static int load_lease(u_int8_t *chaddr, u_int32_t yiaddr, unsigned long lease_time)
+{
+	if (!usable_lease(chaddr, yiaddr)) return 0;
+	return add_lease(chaddr, yiaddr, lease_time) ? 1 : -1;
+}
+
+
+/* the lease file is loaded at startup by writing it straight into the
+ * empty lease table, which is indexed once at the end */
+static u_int32_t bulk_room, bulk_count;
+
+static int bulk_lease(u_int8_t *chaddr, u_int32_t yiaddr, unsigned long lease_time)
+{
+	struct dhcpOfferedAddr *lease;
+
+	if (!usable_lease(chaddr, yiaddr)) return 0;
+	if (bulk_count == bulk_room) return -1;
+	lease = &leases[bulk_count++];
+	memset(lease, 0, sizeof(struct dhcpOfferedAddr));
+	memcpy(lease->chaddr, chaddr, LEASE_CHADDR_LEN);
+	lease->yiaddr = yiaddr;
+	lease->expires = time(0) + lease_time;
+	return 1;
+}
+
+
+/* load a lease file with a header, returns the number of leases or -1 if it is bad */
+static int read_lease_db(char *file, void *map, size_t size)
+{
+	struct lease_file_header *header = map;
+	struct dhcpOfferedAddr *record = (struct dhcpOfferedAddr *) (header + 1);
+	u_int32_t sum[2] = {0, 0}, i;
+	unsigned long curr = time(0), lease_time;
+	int count = 0, ret;
+
+	if (header->version != LEASE_FILE_VERSION ||
+	    header->record_size != sizeof(struct dhcpOfferedAddr) ||
+	    header->count > (size - sizeof(*header)) / sizeof(struct dhcpOfferedAddr))
+		return -1;
+	lease_checksum(sum, record, header->count);
+	if ((sum[0] ^ sum[1]) != header->checksum) return -1;
+
+	bulk_room = prepare_bulk_load(header->count);
+	for (i = 0; i < header->count; i++, record++) {
+		/* without a clock that survives reboots, no time passed since it was written */
+		if (server_config.remaining)
+			lease_time = record->expires > header->written ? record->expires - header->written : 0;
+		else lease_time = record->expires > curr ? record->expires - curr : 0;
+		if ((ret = bulk_lease(record->chaddr, record->yiaddr, lease_time)) < 0) {
+			LOG(LOG_WARNING, "Too many leases while loading %s", file);
+			break;
+		}
+		count += ret;
+	}
+	return count;
+}
+
+
+/* load the records of the journal or of an old style lease file through load */
+static int read_lease_records(char *file, void *map, size_t size,
+			      int (*load)(u_int8_t *, u_int32_t, unsigned long))
+{
+	struct lease_record *record = map;
+	unsigned long lease_time;
+	int count = 0, ret;
+	size_t i;
+
+	for (i = 0; i < size / sizeof(struct lease_record); i++, record++) {
+		lease_time = ntohl(record->expires);
+		if (!server_config.remaining) lease_time -= time(0);
+		if ((ret = load(record->chaddr, record->yiaddr, lease_time)) < 0) {
+			LOG(LOG_WARNING, "Too many leases while loading %s", file);
+			break;
+		}
+		count += ret;
+	}
+	return count;
+}
+
+
+/* map a whole file for reading, returns NULL if it is missing or empty */
+static void *map_file(char *file, size_t *size)
+{
+	int fd;
+	struct stat st;
+	void *map;
+
+	if ((fd = open(file, O_RDONLY)) < 0) {
+		LOG(LOG_ERR, "Unable to open %s for reading", file);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		LOG(LOG_ERR, "Unable to map %s", file);
+		map = NULL;
+	}
+	close(fd);
+	*size = st.st_size;
+	return map;
+}
+
+
 /*
 	* 将lease_file文件中记录的租赁出去的IP信息更新到链表struct dhcpOfferedAddr *leases中
 	* read_leases函数主要是在udhcpd意外重启后恢复之前租赁出去IP的信息到struct dhcpOfferedAddr *leases中
@@ -298,29 +653,82 @@ void write_leases(void)
 */
 void read_leases(char *file)
 {
-	FILE *fp;
-	unsigned int i = 0;
-	struct dhcpOfferedAddr lease;
-	
-	if (!(fp = fopen(file, "r"))) {
-		LOG(LOG_ERR, "Unable to open %s for reading", file);
-		return;
-	}
-	
-	while (i < server_config.max_leases && (fread(&lease, sizeof lease, 1, fp) == 1)) {
-		/* ADDME: is it a static lease */
-		if (lease.yiaddr >= server_config.start && lease.yiaddr <= server_config.end) {
-			lease.expires = ntohl(lease.expires);
-			if (!server_config.remaining) lease.expires -= time(0);
-			if (!(add_lease(lease.chaddr, lease.yiaddr, lease.expires))) {
-				LOG(LOG_WARNING, "Too many leases while loading %s\n", file);
-				break;
-			}				
-			i++;
+	int count = 0;
+	u_int32_t kept;
+	size_t size;
+	void *map;
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
+	if (!(map = map_file(file, &size))) return;
+
+	/* files without a header are from an older udhcpd */
+	bulk_count = 0;
+	if (size >= sizeof(struct lease_file_header) &&
+	    ((struct lease_file_header *) map)->magic == LEASE_FILE_MAGIC) {
+		if ((count = read_lease_db(file, map, size)) < 0) {
+			LOG(LOG_ERR, "%s is corrupt, ignoring it", file);
+			count = 0;
 		}
+	} else if (size >= sizeof(struct lease_file_header) &&
+		   ((struct lease_file_header *) map)->magic == LEASE_FILE_SWAPPED) {
+		/* its records are in the other byte order too */
+		LOG(LOG_ERR, "%s was written on a host of the other byte order, ignoring it", file);
+	} else {
+		bulk_room = prepare_bulk_load(size / sizeof(struct lease_record));
+		count = read_lease_records(file, map, size, bulk_lease);
 	}
-	DEBUG(LOG_INFO, "Read %d leases", i);
-	fclose(fp);
+	munmap(map, size);
+
+	/* a client or an address that shows up twice keeps its last lease */
+	kept = finish_bulk_load();
+	gettimeofday(&end, NULL);
+	LOG(LOG_INFO, "Loaded %u leases from %s in %ld ms (%d duplicates dropped)", kept, file,
+		(end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000,
+		count - (int) kept);
+}
+
+
+/* replay the journal file of the last run, one lease at a time */
+static void replay_journal(char *file)
+{
+	size_t size;
+	void *map;
+	int count;
+
+	if (!(map = map_file(file, &size))) return;
+	count = read_lease_records(file, map, size, load_lease);
+	munmap(map, size);
+	LOG(LOG_INFO, "Replayed %d leases from %s", count, file);
+}
+
+
+/* replay the journal left by the last run on top of the lease file, and
+ * start appending to it. Records written later override earlier ones. */
+void read_journal(void)
+{
+	journal_file = xmalloc(strlen(server_config.lease_file) + 9);
+	sprintf(journal_file, "%s.journal", server_config.lease_file);
+	journal_old = xmalloc(strlen(journal_file) + 5);
+	sprintf(journal_old, "%s.old", journal_file);
+
+	/* a background write did not finish, its part of the journal comes first */
+	if (!access(journal_old, F_OK))
+		replay_journal(journal_old);
+	if (!access(journal_file, F_OK))
+		replay_journal(journal_file);
+	if ((journal_fd = open(journal_file, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0)
+		LOG(LOG_ERR, "Unable to open %s, leases are only saved every auto_time", journal_file);
+}
+
+
+/* append the current state of lease to the journal */
+void journal_lease(struct dhcpOfferedAddr *lease)
+{
+	struct lease_record record;
+
+	if (journal_fd < 0) return;
+	fill_record(&record, lease, time(0));
+	if (write(journal_fd, &record, sizeof(record)) != sizeof(record))
+		LOG(LOG_ERR, "Unable to append to %s", journal_file);
 }
-		
-		
@@ -12,6 +12,10 @@ struct config_keyword {
 
 int read_config(char *file);
 void write_leases(void);
+void save_leases(void);
+void finish_save(int block);
 void read_leases(char *file);
+void read_journal(void);
+void journal_lease(struct dhcpOfferedAddr *lease);
 
 #endif
@@ -5,6 +5,7 @@
 
 #include <time.h>
 #include <string.h>
+#include <stdlib.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -15,25 +16,483 @@
 #include "options.h"
 #include "leases.h"
 #include "arpping.h"
+#include "static_leases.h"
 
 unsigned char blank_chaddr[] = {[0 ... 15] = 0};
 
+/* number of slots in the lease table, it grows by doubling up to max_leases
+ * and compact_leases() shrinks it again once it is mostly empty */
+u_int32_t lease_slots;
+
+/* chaddr hash index, chains are lease table indexes ended by LEASE_NONE */
+#define LEASE_NONE	((u_int32_t) -1)
+static u_int32_t *chaddr_hash;
+static u_int32_t *chaddr_next;
+static u_int32_t chaddr_mask;
+
+
+static u_int32_t hash_chaddr(u_int8_t *chaddr)
+{
+	u_int32_t hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < LEASE_CHADDR_LEN; i++)
+		hash = (hash ^ chaddr[i]) * 16777619U;
+	return hash & chaddr_mask;
+}
+
+
+/* link lease i into its chaddr chain, blank hardware addresses are not indexed */
+static void hash_lease(u_int32_t i)
+{
+	u_int32_t bucket;
+
+	if (!memcmp(leases[i].chaddr, blank_chaddr, LEASE_CHADDR_LEN)) return;
+	bucket = hash_chaddr(leases[i].chaddr);
+	chaddr_next[i] = chaddr_hash[bucket];
+	chaddr_hash[bucket] = i;
+}
+
+
+static void unhash_lease(u_int32_t i)
+{
+	u_int32_t *curr;
+
+	if (!memcmp(leases[i].chaddr, blank_chaddr, LEASE_CHADDR_LEN)) return;
+	for (curr = &chaddr_hash[hash_chaddr(leases[i].chaddr)];
+	     *curr != LEASE_NONE; curr = &chaddr_next[*curr])
+		if (*curr == i) {
+			*curr = chaddr_next[i];
+			break;
+		}
+}
+
+
+/* yiaddr index: the pools are laid out one after the other, pool_slot maps an
+ * offset into them to its lease, free_map has a bit set for every address
+ * that can still be handed out */
+#define WORD_BITS	(sizeof(unsigned long) * 8)
+static u_int32_t pool_size;
+static u_int32_t *pool_slot;
+static unsigned long *free_map;
+
+
+/* binary search the relayed pools (sorted by address) for the last one
+ * whose first address, or subnet if by_subnet is set, is at most addr */
+static struct pool_t *last_pool_below(u_int32_t addr, int by_subnet)
+{
+	struct pool_t *pools = server_config.pools;
+	u_int32_t lo = 1, hi = server_config.pool_count, mid, key;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		key = ntohl(pools[mid].start & (by_subnet ? pools[mid].mask : 0xffffffff));
+		if (key <= addr) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo > 1 ? &pools[lo - 1] : NULL;
+}
+
+
+/* the pool serving a client, by the relay it came through, or our own if
+ * giaddr is 0. A relay no pool line matches is served from start - end if
+ * it is on that block's subnet, which without a subnet option is any relay.
+ * NULL if we have no pool for that relay */
+struct pool_t *find_pool(u_int32_t giaddr)
+{
+	struct pool_t *pool = server_config.pools;
+
+	if (!giaddr) return pool;
+	if ((pool = last_pool_below(ntohl(giaddr), 1)) &&
+	    (giaddr & pool->mask) == (pool->start & pool->mask))
+		return pool;
+	pool = server_config.pools;
+	if ((giaddr & pool->mask) == (pool->start & pool->mask))
+		return pool;
+	return NULL;
+}
+
+
+/* the pool yiaddr belongs to, NULL if it is in none */
+struct pool_t *find_pool_by_yiaddr(u_int32_t yiaddr)
+{
+	struct pool_t *pool = server_config.pools;
+	u_int32_t addr = ntohl(yiaddr);
+
+	if (pool->size && addr >= ntohl(pool->start) && addr <= ntohl(pool->end))
+		return pool;
+	if ((pool = last_pool_below(addr, 0)) && addr <= ntohl(pool->end))
+		return pool;
+	return NULL;
+}
+
+
+/* the pool a reserved address is served from: the one it is in, else the
+ * one for its subnet. One on no subnet we know is taken as our own */
+struct pool_t *reserved_pool(u_int32_t yiaddr)
+{
+	struct pool_t *pool;
+
+	if ((pool = find_pool_by_yiaddr(yiaddr)) || (pool = find_pool(yiaddr)))
+		return pool;
+	return server_config.pools;
+}
+
+
+/* the pool yiaddr is in, its offset into the pool index is returned in offset */
+static struct pool_t *pool_offset(u_int32_t yiaddr, u_int32_t *offset)
+{
+	struct pool_t *pool;
+
+	if (!(pool = find_pool_by_yiaddr(yiaddr))) return NULL;
+	*offset = pool->base + ntohl(yiaddr) - ntohl(pool->start);
+	return pool;
+}
+
+
+static void mark_free(struct pool_t *pool, u_int32_t offset, int avail)
+{
+	u_int32_t addr = ntohl(pool->start) + offset - pool->base;
+
+	/* .0 and .255 addresses are never handed out, reserved ones only to their owner */
+	if (avail && (addr & 0xFF) && (addr & 0xFF) != 0xFF && !static_ip_reserved(htonl(addr)))
+		free_map[offset / WORD_BITS] |= 1UL << (offset % WORD_BITS);
+	else free_map[offset / WORD_BITS] &= ~(1UL << (offset % WORD_BITS));
+}
+
+
+/* find the first free offset of pool at or after from, a word at a time */
+static int next_free(struct pool_t *pool, u_int32_t from, u_int32_t *offset)
+{
+	u_int32_t word = from / WORD_BITS, limit = pool->base + pool->size;
+	unsigned long bits;
+
+	if (from >= limit) return 0;
+	bits = free_map[word] & (~0UL << (from % WORD_BITS));
+	while (!bits) {
+		if (++word * WORD_BITS >= limit) return 0;
+		bits = free_map[word];
+	}
+	for (*offset = word * WORD_BITS; !(bits & 1); bits >>= 1)
+		(*offset)++;
+	return *offset < limit;
+}
+
+
+static void index_yiaddr(u_int32_t i)
+{
+	struct pool_t *pool;
+	u_int32_t offset;
+
+	if ((pool = pool_offset(leases[i].yiaddr, &offset))) {
+		pool_slot[offset] = i;
+		mark_free(pool, offset, 0);
+	}
+}
+
+
+static void unindex_yiaddr(u_int32_t i)
+{
+	struct pool_t *pool;
+	u_int32_t offset;
+
+	if ((pool = pool_offset(leases[i].yiaddr, &offset)) && pool_slot[offset] == i) {
+		pool_slot[offset] = LEASE_NONE;
+		mark_free(pool, offset, 1);
+	}
+}
+
+
+static int pool_cmp(const void *a, const void *b)
+{
+	u_int32_t x = ntohl(((struct pool_t *) a)->start), y = ntohl(((struct pool_t *) b)->start);
+
+	return x < y ? -1 : x > y;
+}
+
+
+/* put the start - end pool in front of the relayed ones, sort those by
+ * address, dropping overlapping ones, and lay them all out in the index */
+static void init_pools(void)
+{
+	struct pool_t *pools, *pool;
+	struct option_set *option;
+	struct in_addr addr;
+	u_int32_t i, n;
+
+	pools = xrealloc(server_config.pools, sizeof(struct pool_t) * (server_config.pool_count + 1));
+	memmove(pools + 1, pools, sizeof(struct pool_t) * server_config.pool_count);
+	memset(pools, 0, sizeof(struct pool_t));
+	pools[0].start = server_config.start;
+	pools[0].end = server_config.end;
+	if ((option = find_option(server_config.options, DHCP_SUBNET)))
+		memcpy(&pools[0].mask, option->data + 2, 4);
+	if (ntohl(pools[0].end) >= ntohl(pools[0].start))
+		pools[0].size = ntohl(pools[0].end) - ntohl(pools[0].start) + 1;
+	qsort(pools + 1, server_config.pool_count, sizeof(struct pool_t), pool_cmp);
+
+	/* relayed subnets may not overlap, or giaddr could not tell them apart */
+	for (i = n = 1; i <= server_config.pool_count; i++) {
+		pool = &pools[i];
+		if ((pools[0].size && ntohl(pool->start) <= ntohl(pools[0].end) &&
+		     ntohl(pool->end) >= ntohl(pools[0].start)) ||
+		    (n > 1 && ntohl(pools[n - 1].start | ~pools[n - 1].mask) >=
+		     ntohl(pool->start & pool->mask))) {
+			addr.s_addr = pool->start;
+			LOG(LOG_ERR, "pool at %s overlaps another pool, ignoring it", inet_ntoa(addr));
+			continue;
+		}
+		pool->size = ntohl(pool->end) - ntohl(pool->start) + 1;
+		pools[n++] = *pool;
+	}
+	server_config.pools = pools;
+	server_config.pool_count = n;
+
+	for (pool = pools; pool < pools + n; pool++) {
+		pool->base = pool->cursor = pool_size;
+		pool_size += pool->size;
+	}
+}
+
+
+
+/* expiry index: a binary min-heap of every slot in the table keyed on
+ * expires, so empty slots (expires 0) and expired leases sit at the top */
+static u_int32_t *heap;
+static u_int32_t *heap_pos;
+
+#define HEAP_KEY(pos)	(leases[heap[pos]].expires)
+
+static void heap_swap(u_int32_t a, u_int32_t b)
+{
+	u_int32_t tmp = heap[a];
+
+	heap[a] = heap[b];
+	heap[b] = tmp;
+	heap_pos[heap[a]] = a;
+	heap_pos[heap[b]] = b;
+}
+
+
+static void sift_down(u_int32_t pos)
+{
+	u_int32_t child;
+
+	while ((child = 2 * pos + 1) < lease_slots) {
+		if (child + 1 < lease_slots && HEAP_KEY(child + 1) < HEAP_KEY(child))
+			child++;
+		if (HEAP_KEY(pos) <= HEAP_KEY(child)) break;
+		heap_swap(pos, child);
+		pos = child;
+	}
+}
+
+
+/* restore the heap after the expiry time of lease i changed */
+static void update_heap(u_int32_t i)
+{
+	u_int32_t pos = heap_pos[i];
+
+	while (pos > 0 && HEAP_KEY((pos - 1) / 2) > HEAP_KEY(pos)) {
+		heap_swap(pos, (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+	sift_down(pos);
+}
+
+
+/* remove lease i from the chaddr and yiaddr indexes and empty it */
+static void empty_slot(u_int32_t i)
+{
+	unhash_lease(i);
+	unindex_yiaddr(i);
+	memset(&(leases[i]), 0, sizeof(struct dhcpOfferedAddr));
+}
+
+
+/* remove lease i from the indexes and empty it */
+static void drop_lease(u_int32_t i)
+{
+	empty_slot(i);
+	update_heap(i);
+}
+
+
+/* rebuild all the indexes from the contents of the lease table. Of leases with
+ * the same chaddr or yiaddr the one in the later slot stays, the others are
+ * emptied. Returns the number of leases in the table */
+static u_int32_t index_leases(void)
+{
+	struct pool_t *pool;
+	struct dhcpOfferedAddr *dup;
+	u_int32_t offset, i, used = 0;
+
+	if (lease_slots)
+		memset(chaddr_hash, 0xff, sizeof(u_int32_t) * (chaddr_mask + 1));
+	memset(pool_slot, 0xff, sizeof(u_int32_t) * pool_size);
+	for (pool = server_config.pools; pool < server_config.pools + server_config.pool_count; pool++)
+		for (offset = pool->base; offset < pool->base + pool->size; offset++)
+			mark_free(pool, offset, 1);
+
+	for (i = 0; i < lease_slots; i++) {
+		heap[i] = heap_pos[i] = i;
+		if (!leases[i].yiaddr) continue;
+		if ((dup = find_lease_by_chaddr(leases[i].chaddr))) {
+			empty_slot(dup - leases);
+			used--;
+		}
+		if ((dup = find_lease_by_yiaddr(leases[i].yiaddr))) {
+			empty_slot(dup - leases);
+			used--;
+		}
+		hash_lease(i);
+		index_yiaddr(i);
+		used++;
+	}
+	for (i = lease_slots / 2; i-- > 0;)
+		sift_down(i);
+	return used;
+}
+
+
+/* move the lease table and its per slot indexes to a table of slots entries.
+ * New slots are empty, the caller has to empty the ones cut off and
+ * index_leases() afterwards. On failure the table is left as it was. */
+static int resize_leases(u_int32_t slots)
+{
+	struct dhcpOfferedAddr *new_leases;
+	u_int32_t *new_slots, buckets;
+
+	for (buckets = 1; buckets < slots; buckets <<= 1);
+
+	if (!(new_leases = xrealloc(leases, sizeof(struct dhcpOfferedAddr) * slots)))
+		return -1;
+	leases = new_leases;
+	if (!(new_slots = xrealloc(chaddr_next, sizeof(u_int32_t) * slots))) return -1;
+	chaddr_next = new_slots;
+	if (!(new_slots = xrealloc(heap, sizeof(u_int32_t) * slots))) return -1;
+	heap = new_slots;
+	if (!(new_slots = xrealloc(heap_pos, sizeof(u_int32_t) * slots))) return -1;
+	heap_pos = new_slots;
+	if (!(new_slots = xrealloc(chaddr_hash, sizeof(u_int32_t) * buckets))) return -1;
+	chaddr_hash = new_slots;
+
+	if (slots > lease_slots)
+		memset(&(leases[lease_slots]), 0,
+		       sizeof(struct dhcpOfferedAddr) * (slots - lease_slots));
+	chaddr_mask = buckets - 1;
+	lease_slots = slots;
+	return 0;
+}
+
+
+/* double the lease table, up to max_leases */
+static int grow_leases(void)
+{
+	u_int32_t slots = lease_slots * 2;
+
+	if (slots < MIN_LEASE_SLOTS) slots = MIN_LEASE_SLOTS;
+	if (slots > server_config.max_leases) slots = server_config.max_leases;
+	if (slots <= lease_slots || resize_leases(slots) < 0) return -1;
+	index_leases();
+	DEBUG(LOG_INFO, "lease table grown to %u slots", lease_slots);
+	return 0;
+}
+
+
+/* halve the lease table while at most a quarter of it is in use. This moves
+ * leases around, so it may only be called where no lease pointers are held */
+void compact_leases(void)
+{
+	u_int32_t used, slots, i;
+
+	for (i = used = 0; i < lease_slots; i++)
+		if (leases[i].yiaddr) used++;
+	for (slots = lease_slots; slots / 2 >= MIN_LEASE_SLOTS && used <= slots / 4; slots /= 2);
+	if (slots == lease_slots) return;
+
+	/* pack the leases into the front of the table */
+	for (i = used = 0; i < lease_slots; i++)
+		if (leases[i].yiaddr) leases[used++] = leases[i];
+	memset(&(leases[used]), 0, sizeof(struct dhcpOfferedAddr) * (lease_slots - used));
+	resize_leases(slots);
+	index_leases();
+	DEBUG(LOG_INFO, "lease table compacted to %u slots", lease_slots);
+}
+
+
+/* set up the pools, their index and the initial lease table */
+void init_leases(void)
+{
+	u_int32_t slots, limit;
+
+	init_pools();
+	pool_slot = xmalloc(sizeof(u_int32_t) * pool_size);
+	free_map = xmalloc(sizeof(unsigned long) * ((pool_size + WORD_BITS - 1) / WORD_BITS));
+	memset(free_map, 0, sizeof(unsigned long) * ((pool_size + WORD_BITS - 1) / WORD_BITS));
+
+	/* every lease holds a different pool or reserved address, so it never needs more */
+	limit = pool_size + static_lease_count();
+	if (!server_config.max_leases || server_config.max_leases > limit)
+		server_config.max_leases = limit;
+
+	slots = server_config.max_leases < MIN_LEASE_SLOTS ?
+		server_config.max_leases : MIN_LEASE_SLOTS;
+	if (slots && resize_leases(slots) < 0)
+		LOG(LOG_ERR, "Unable to allocate the lease table");
+	index_leases();
+}
+
+
+/* make room for count leases read at startup, which the caller writes straight
+ * into the empty table before finish_bulk_load(). Returns the number of slots */
+u_int32_t prepare_bulk_load(u_int32_t count)
+{
+	if (count > server_config.max_leases) count = server_config.max_leases;
+	if (count > lease_slots) resize_leases(count);
+	return lease_slots;
+}
+
+
+/* index the leases written into the table, in one pass and building the
+ * expiry heap once. Returns the number of leases kept */
+u_int32_t finish_bulk_load(void)
+{
+	return index_leases();
+}
+
+
+/* change the owner of a lease, keeping the chaddr index and the journal in step */
+void lease_set_chaddr(struct dhcpOfferedAddr *lease, u_int8_t *chaddr)
+{
+	unhash_lease(lease - leases);
+	memcpy(lease->chaddr, chaddr, LEASE_CHADDR_LEN);
+	hash_lease(lease - leases);
+	journal_lease(lease);
+}
+
+
+/* change the expiry time of a lease, keeping the expiry heap and the journal in step */
+void lease_set_expires(struct dhcpOfferedAddr *lease, unsigned long expires)
+{
+	lease->expires = expires;
+	update_heap(lease - leases);
+	journal_lease(lease);
+}
+
 /* 
 	clear every lease out that chaddr OR yiaddr matches and is nonzero 
 	遍历leases链表找到chaddr或yiaddr对应的节点,将节点置0.
 */
 void clear_lease(u_int8_t *chaddr, u_int32_t yiaddr)
 {
-	unsigned int i, j;
-	
-	for (j = 0; j < 16 && !chaddr[j]; j++);
-	/* j==16 表示chaddr数组为空,只需要比较yiaddr(小技巧) */
+	struct dhcpOfferedAddr *lease;
 
-	for (i = 0; i < server_config.max_leases; i++)
-		if ((j != 16 && !memcmp(leases[i].chaddr, chaddr, 16)) ||
-		    (yiaddr && leases[i].yiaddr == yiaddr)) {
-			memset(&(leases[i]), 0, sizeof(struct dhcpOfferedAddr));
-		}
+	/* the indexes hold at most one lease per nonzero chaddr and per yiaddr */
+	if ((lease = find_lease_by_chaddr(chaddr)))
+		drop_lease(lease - leases);
+	if (yiaddr && (lease = find_lease_by_yiaddr(yiaddr)))
+		drop_lease(lease - leases);
 }
 
 
@@ -50,11 +509,20 @@ struct dhcpOfferedAddr *add_lease(u_int8_t *chaddr, u_int32_t yiaddr, unsigned l
 	clear_lease(chaddr, yiaddr);
 		
 	oldest = oldest_expired_lease();
+
+	/* grow the table rather than reuse an expired lease, its client may come back */
+	if ((!oldest || oldest->yiaddr) && grow_leases() == 0)
+		oldest = oldest_expired_lease();
 	
 	if (oldest) {
-		memcpy(oldest->chaddr, chaddr, 16);
+		drop_lease(oldest - leases);
+		memcpy(oldest->chaddr, chaddr, LEASE_CHADDR_LEN);
+		hash_lease(oldest - leases);
 		oldest->yiaddr = yiaddr;
+		index_yiaddr(oldest - leases);
 		oldest->expires = time(0) + lease;
+		update_heap(oldest - leases);
+		journal_lease(oldest);
 	}
 	
 	return oldest;
@@ -77,18 +545,9 @@ int lease_expired(struct dhcpOfferedAddr *lease)
 */
 struct dhcpOfferedAddr *oldest_expired_lease(void)
 {
-	struct dhcpOfferedAddr *oldest = NULL;
-	unsigned long oldest_lease = time(0);
-	unsigned int i;
-
-	
-	for (i = 0; i < server_config.max_leases; i++)
-		if (oldest_lease > leases[i].expires) {
-			oldest_lease = leases[i].expires;
-			oldest = &(leases[i]);
-		}
-	return oldest;
-		
+	if (!lease_slots || !lease_expired(&(leases[heap[0]])))
+		return NULL;
+	return &(leases[heap[0]]);
 }
 
 
@@ -98,63 +557,91 @@ struct dhcpOfferedAddr *oldest_expired_lease(void)
 */
 struct dhcpOfferedAddr *find_lease_by_chaddr(u_int8_t *chaddr)
 {
-	unsigned int i;
+	u_int32_t i;
 
-	for (i = 0; i < server_config.max_leases; i++)
-		if (!memcmp(leases[i].chaddr, chaddr, 16)) return &(leases[i]);
+	if (!lease_slots || !memcmp(chaddr, blank_chaddr, LEASE_CHADDR_LEN)) return NULL;
+	for (i = chaddr_hash[hash_chaddr(chaddr)]; i != LEASE_NONE; i = chaddr_next[i])
+		if (!memcmp(leases[i].chaddr, chaddr, LEASE_CHADDR_LEN)) return &(leases[i]);
 	
 	return NULL;
 }
 
 
 /*
-	Find the first lease that matches yiaddr, NULL is no match 
+	Find the lease that matches yiaddr, NULL is no match 
 	通过yiaddr值找到leases中节点,返回节点地址.
 */
 struct dhcpOfferedAddr *find_lease_by_yiaddr(u_int32_t yiaddr)
 {
-	unsigned int i;
+	u_int32_t offset;
 
-	for (i = 0; i < server_config.max_leases; i++)
-		if (leases[i].yiaddr == yiaddr) return &(leases[i]);
-	
-	return NULL;
+	if (!pool_offset(yiaddr, &offset) || pool_slot[offset] == LEASE_NONE)
+		return NULL;
+	return &(leases[pool_slot[offset]]);
 }
 
 
-/* find an assignable address, it check_expired is true, we check all the expired leases as well.
- * Maybe this should try expired leases by age... 
- * 在地址池中返回一个没有被分配的地址.
-*/
-u_int32_t find_address(int check_expired) 
+/* find an expired lease of pool in the heap below pos, they form a subtree at the top */
+static u_int32_t find_expired(struct pool_t *pool, u_int32_t pos)
 {
-	u_int32_t addr, ret;
-	struct dhcpOfferedAddr *lease = NULL;		
+	struct dhcpOfferedAddr *lease;
+	u_int32_t offset, ret;
+
+	if (pos >= lease_slots) return 0;
+	lease = &(leases[heap[pos]]);
+	if (!lease_expired(lease)) return 0;
 
-	addr = ntohl(server_config.start); /* addr is in host order here */
-	for (;addr <= ntohl(server_config.end); addr++) {
+	ret = lease->yiaddr;
+	if (pool_offset(ret, &offset) == pool &&
 
-		/* 排除地址池中.0和.255结尾的地址 */
-		/* ie, 192.168.55.0 */
-		if (!(addr & 0xFF)) continue;
+	    /* ie, 192.168.55.0 and 192.168.55.255 */
+	    (ntohl(ret) & 0xFF) && (ntohl(ret) & 0xFF) != 0xFF && !static_ip_reserved(ret))
+		return ret;
 
-		/* ie, 192.168.55.255 */
-		if ((addr & 0xFF) == 0xFF) continue;
+	if ((ret = find_expired(pool, 2 * pos + 1))) return ret;
+	return find_expired(pool, 2 * pos + 2);
+}
 
-		/* lease is not taken */
-		ret = htonl(addr);
-		if ((!(lease = find_lease_by_yiaddr(ret)) ||
 
-		     /* or it expired and we are checking for expired leases */
-		     (check_expired  && lease_expired(lease))) &&
+/* find an assignable address of pool, it check_expired is true, we check all the expired leases as well.
+ * Free addresses are taken from a rotating cursor over the pool's part of the free
+ * map, so a released address is not handed out again until the rest of the pool was.
+ * Expired leases are tried oldest first from the top of the expiry heap.
+ * The address is not probed here, the caller has to check_ip() it or ARP
+ * probe it itself, a conflict is recorded as a lease so the next call moves on.
+ * 在地址池中返回一个没有被分配的地址.
+*/
+u_int32_t find_address(struct pool_t *pool, int check_expired) 
+{
+	u_int32_t offset, from;
 
-		     /* and it isn't on the network */
-	    	     !check_ip(ret)) {
-			return ret;
-			break;
-		}
+	/* from the cursor to the end of the pool, then from the start up to the cursor */
+	if (next_free(pool, pool->cursor, &offset) || next_free(pool, pool->base, &offset)) {
+		from = offset + 1;
+		pool->cursor = from < pool->base + pool->size ? from : pool->base;
+		return htonl(ntohl(pool->start) + offset - pool->base);
 	}
-	return 0;
+	if (!check_expired) return 0;
+
+	/* or it expired and we are checking for expired leases */
+	return find_expired(pool, 0);
+}
+
+
+/* an address answered an ARP probe, reserve it for conflict_time */
+void mark_conflict(u_int32_t addr)
+{
+	struct in_addr temp;
+
+	temp.s_addr = addr;
+	LOG(LOG_INFO, "%s belongs to someone, reserving it for %ld seconds", 
+		inet_ntoa(temp), server_config.conflict_time);
+	/* 
+		blank_chaddr 黑户? 因为不知道使用这个IP的主机的MAC地址 
+		如果有主机回应arp,完全可以获得IP所对应的MAC地址，这里应该是不关心这个MAC了，所以
+		MAC全部记为0
+	*/
+	add_lease(blank_chaddr, addr, server_config.conflict_time);
 }
 
 
@@ -167,19 +654,15 @@ u_int32_t find_address(int check_expired)
 */
 int check_ip(u_int32_t addr)
 {
-	struct in_addr temp;
+	int is_free;
+
 	/* arpping 发送一个arp广播包,经过一段时间等待后如果此IP没有被局域网内的主机使用就收不到单播回复,返回1 */	
-	if (arpping(addr, server_config.server, server_config.arp, server_config.interface) == 0) {
-		temp.s_addr = addr;
-	 	LOG(LOG_INFO, "%s belongs to someone, reserving it for %ld seconds", 
-	 		inet_ntoa(temp), server_config.conflict_time);
-	 	/* 
-	 		blank_chaddr 黑户? 因为不知道使用这个IP的主机的MAC地址 
-			如果有主机回应arp,完全可以获得IP所对应的MAC地址，这里应该是不关心这个MAC了，所以
-			MAC全部记为0
-	 	*/
-		add_lease(blank_chaddr, addr, server_config.conflict_time);
+	if ((is_free = arp_cache_lookup(addr)) < 0) {
+		is_free = arpping(addr, server_config.server, server_config.arp, server_config.ifindex);
+		if (is_free >= 0) arp_cache_store(addr, is_free);
+	}
+	if (is_free == 0) {
+		mark_conflict(addr);
 		return 1;
 	} else return 0;
 }
-
@@ -3,21 +3,56 @@
 #define _LEASES_H
 
 
+/* only the first LEASE_CHADDR_LEN bytes of a chaddr are kept and compared,
+ * enough for an ethernet address */
+#define LEASE_CHADDR_LEN	6
+
 struct dhcpOfferedAddr {
-	u_int8_t  chaddr[16];
+	u_int8_t  chaddr[LEASE_CHADDR_LEN];
 	u_int32_t yiaddr;	/* network order */
 	u_int32_t expires;	/* host order */
 };
 
+/* the lease file is a header followed by count records laid out exactly as
+ * struct dhcpOfferedAddr, in host byte order, with expires as absolute time */
+#define LEASE_FILE_MAGIC	0x75644c46	/* "udLF" */
+#define LEASE_FILE_SWAPPED	0x464c6475	/* the magic as read on the other byte order */
+#define LEASE_FILE_VERSION	1
+
+struct lease_file_header {
+	u_int32_t magic;
+	u_int16_t version;
+	u_int16_t record_size;	/* sizeof(struct dhcpOfferedAddr) */
+	u_int32_t count;	/* number of records */
+	u_int32_t written;	/* time(0) when the file was written */
+	u_int32_t checksum;	/* of the records */
+	u_int32_t reserved[3];
+};
+
+/* leases has lease_slots entries. add_lease() and compact_leases() may move
+ * the table, which invalidates any lease pointer taken before the call */
+extern u_int32_t lease_slots;
 extern unsigned char blank_chaddr[];
 
+struct pool_t;
+
+void init_leases(void);
+void compact_leases(void);
+u_int32_t prepare_bulk_load(u_int32_t count);
+u_int32_t finish_bulk_load(void);
+struct pool_t *find_pool(u_int32_t giaddr);
+struct pool_t *find_pool_by_yiaddr(u_int32_t yiaddr);
+struct pool_t *reserved_pool(u_int32_t yiaddr);
+void lease_set_chaddr(struct dhcpOfferedAddr *lease, u_int8_t *chaddr);
+void lease_set_expires(struct dhcpOfferedAddr *lease, unsigned long expires);
 void clear_lease(u_int8_t *chaddr, u_int32_t yiaddr);
 struct dhcpOfferedAddr *add_lease(u_int8_t *chaddr, u_int32_t yiaddr, unsigned long lease);
 int lease_expired(struct dhcpOfferedAddr *lease);
 struct dhcpOfferedAddr *oldest_expired_lease(void);
 struct dhcpOfferedAddr *find_lease_by_chaddr(u_int8_t *chaddr);
 struct dhcpOfferedAddr *find_lease_by_yiaddr(u_int32_t yiaddr);
-u_int32_t find_address(int check_expired);
+u_int32_t find_address(struct pool_t *pool, int check_expired);
+void mark_conflict(u_int32_t addr);
 int check_ip(u_int32_t addr);
 
 
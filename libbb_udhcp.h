@@ -23,6 +23,7 @@
 #define FALSE			0
 
 #define xmalloc malloc
+#define xrealloc realloc
 
 #endif /* BB_VER */
 
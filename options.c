@@ -78,40 +78,31 @@ int option_lengths[] = {
 /* get an option with bounds checking (warning, not aligned). */
 unsigned char *get_option(struct dhcpMessage *packet, int code)
 {
-	int i, length;
-	unsigned char *optionptr;
-	int over = 0, done = 0, curr = OPTION_FIELD;
-	
-	optionptr = packet->options;
-	i = 0;
-	length = 308;
-	while (!done) {
+	struct option_index index;
+
+	index_options(packet, &index);
+	return indexed_option(packet, &index, code);
+}
+
+
+/* find where every option of packet is in one pass, so they can be looked
+ * up without walking the options again. The first copy of an option is used */
+void index_options(struct dhcpMessage *packet, struct option_index *index)
+{
+	unsigned char *optionptr = packet->options;
+	int i = 0, length = 308, over = 0, curr = OPTION_FIELD;
+
+	memset(index, 0, sizeof(struct option_index));
+	while (1) {
 		if (i >= length) {
 			LOG(LOG_WARNING, "bogus packet, option fields too long.");
-			return NULL;
+			return;
 		}
-		/* 检查code值是否匹配 */
-		if (optionptr[i + OPT_CODE] == code) {
-			if (i + 1 + optionptr[i + OPT_LEN] >= length) {
-				LOG(LOG_WARNING, "bogus packet, option fields too long.");
-				return NULL;
-			}
-			return optionptr + i + 2;
-		}		
-
 		/* 处理选项中特殊字段，DHCP_PADDING(跳过)， DHCP_END(结束)，DHCP_OPTION_OVER(自定义)*/	
 		switch (optionptr[i + OPT_CODE]) {
 		case DHCP_PADDING:
 			i++;
 			break;
-		case DHCP_OPTION_OVER:
-			if (i + 1 + optionptr[i + OPT_LEN] >= length) {
-				LOG(LOG_WARNING, "bogus packet, option fields too long.");
-				return NULL;
-			}
-			over = optionptr[i + 3];
-			i += optionptr[OPT_LEN] + 2;
-			break;
 		case DHCP_END:
 			if (curr == OPTION_FIELD && over & FILE_FIELD) {
 				optionptr = packet->file;
@@ -123,13 +114,28 @@ unsigned char *get_option(struct dhcpMessage *packet, int code)
 				i = 0;
 				length = 64;
 				curr = SNAME_FIELD;
-			} else done = 1;
+			} else return;
 			break;
 		default:
-			i += optionptr[OPT_LEN + i] + 2;//指针指向下一个选项值的code字段
+			if (i + OPT_LEN >= length || i + 1 + optionptr[i + OPT_LEN] >= length) {
+				LOG(LOG_WARNING, "bogus packet, option fields too long.");
+				return;
+			}
+			if (!index->offset[optionptr[i + OPT_CODE]])
+				index->offset[optionptr[i + OPT_CODE]] =
+					optionptr + i + OPT_DATA - (unsigned char *) packet;
+			if (optionptr[i + OPT_CODE] == DHCP_OPTION_OVER && optionptr[i + OPT_LEN])
+				over = optionptr[i + OPT_DATA];
+			i += optionptr[i + OPT_LEN] + 2;//指针指向下一个选项值的code字段
 		}
 	}
-	return NULL;
+}
+
+
+/* look up an option found by index_options(), NULL if the packet does not have it */
+unsigned char *indexed_option(struct dhcpMessage *packet, struct option_index *index, unsigned char code)
+{
+	return index->offset[code] ? (unsigned char *) packet + index->offset[code] : NULL;
 }
 
 
@@ -27,10 +27,17 @@ struct dhcp_option {
 	unsigned char code;
 };
 
+/* where the options of a received packet are, found in one pass by index_options() */
+struct option_index {
+	u_int16_t offset[256];		/* of each option's data in the packet, 0 if it is not there */
+};
+
 extern struct dhcp_option options[];
 extern int option_lengths[];
 
 unsigned char *get_option(struct dhcpMessage *packet, int code);
+void index_options(struct dhcpMessage *packet, struct option_index *index);
+unsigned char *indexed_option(struct dhcpMessage *packet, struct option_index *index, unsigned char code);
 int end_option(unsigned char *optionptr);
 int add_option_string(unsigned char *optionptr, unsigned char *string);
 int add_simple_option(unsigned char *optionptr, unsigned char code, u_int32_t data);
@@ -1,5 +1,7 @@
+#define _GNU_SOURCE		/* for recvmmsg() */
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -43,10 +45,20 @@ void init_header(struct dhcpMessage *packet, char type)
 }
 
 
-/* read a packet from socket fd, return -1 on read error, -2 on packet error */
-int get_packet(struct dhcpMessage *packet, int fd)
+/* the length of payload up to its end option, but at least BOOTP_MIN_LEN.
+ * Everything after the end option must be zero */
+int dhcp_packet_len(struct dhcpMessage *payload)
+{
+	int len = offsetof(struct dhcpMessage, options) + end_option(payload->options) + 1;
+
+	return len < BOOTP_MIN_LEN ? BOOTP_MIN_LEN : len;
+}
+
+
+/* check a packet that was read, and index its options if index is given.
+ * Returns -2 if it is bogus */
+static int check_packet(struct dhcpMessage *packet, struct option_index *index)
 {
-	int bytes;
 	int i;
 	const char broken_vendors[][8] = {
 		"MSFT 98",
@@ -54,13 +66,6 @@ int get_packet(struct dhcpMessage *packet, int fd)
 	};
 	char unsigned *vendor;
 
-	memset(packet, 0, sizeof(struct dhcpMessage));
-	bytes = read(fd, packet, sizeof(struct dhcpMessage));
-	if (bytes < 0) {
-		DEBUG(LOG_INFO, "couldn't read on listening socket, ignoring");
-		return -1;
-	}
-
 	/* packet->cookie(Default:0x63825363)字段丢掉假冒的DHCP client报文 */
 	if (ntohl(packet->cookie) != DHCP_MAGIC) {
 		LOG(LOG_ERR, "received bogus message, ignoring");
@@ -68,7 +73,9 @@ int get_packet(struct dhcpMessage *packet, int fd)
 	}
 	DEBUG(LOG_INFO, "Received a packet");
 	
-	if (packet->op == BOOTREQUEST && (vendor = get_option(packet, DHCP_VENDOR))) {
+	if (index) index_options(packet, index);
+	if (packet->op == BOOTREQUEST && (vendor = index ? indexed_option(packet, index, DHCP_VENDOR) :
+					  get_option(packet, DHCP_VENDOR))) {
 		for (i = 0; broken_vendors[i][0]; i++) {
 			if (vendor[OPT_LEN - 2] == (unsigned char) strlen(broken_vendors[i]) &&
 			    !strncmp(vendor, broken_vendors[i], vendor[OPT_LEN - 2])) {
@@ -78,23 +85,87 @@ int get_packet(struct dhcpMessage *packet, int fd)
 			}
 		}
 	}
-			    	
+	return 0;
+}
+
+
+/* read a packet from socket fd, return -1 on read error, -2 on packet error.
+ * If index is given, the options of the packet are indexed into it */
+int get_packet(struct dhcpMessage *packet, struct option_index *index, int fd)
+{
+	int bytes;
 
+	memset(packet, 0, sizeof(struct dhcpMessage));
+	bytes = read(fd, packet, sizeof(struct dhcpMessage));
+	if (bytes < 0) {
+		DEBUG(LOG_INFO, "couldn't read on listening socket, ignoring");
+		return -1;
+	}
+	if (check_packet(packet, index) < 0)
+		return -2;
 	return bytes;
 }
 
 
-u_int16_t checksum(void *addr, int count)
+/* read as many as count packets waiting on fd with one call, without
+ * blocking, and index their options. A bogus packet is left with no
+ * options. Returns the number read, or -1 on read error */
+int get_packets(struct dhcpMessage *packets, struct option_index *index, int count, int fd)
 {
-	/* Compute Internet Checksum for "count" bytes
-	 *         beginning at location "addr".
-	 */
-	register int32_t sum = 0;
-	u_int16_t *source = (u_int16_t *) addr;
-
-	while (count > 1)  {
-		/*  This is the inner loop */
-		sum += *source++;
+	struct mmsghdr msgs[MAX_BATCH_SIZE];
+	struct iovec iov[MAX_BATCH_SIZE];
+	int i, n;
+
+	if (count > MAX_BATCH_SIZE) count = MAX_BATCH_SIZE;
+	memset(msgs, 0, sizeof(struct mmsghdr) * count);
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = &packets[i];
+		iov[i].iov_len = sizeof(struct dhcpMessage);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	if ((n = recvmmsg(fd, msgs, count, MSG_DONTWAIT, NULL)) < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+		DEBUG(LOG_INFO, "couldn't read on listening socket, ignoring");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		/* clear what the last packet read here left past the end of this one */
+		memset((unsigned char *) &packets[i] + msgs[i].msg_len, 0,
+			sizeof(struct dhcpMessage) - msgs[i].msg_len);
+		if (check_packet(&packets[i], &index[i]) < 0)
+			memset(&index[i], 0, sizeof(struct option_index));
+	}
+	return n;
+}
+
+
+/* add count bytes at addr to a ones' complement sum. It is taken 32 bits
+ * at a time, in host order, the carries pile up in the upper half of sum */
+static u_int64_t checksum_add(u_int64_t sum, void *addr, int count)
+{
+	unsigned char *source = addr;
+	u_int32_t word[4];
+	u_int16_t tmp;
+
+	/*  This is the inner loop */
+	while (count >= 16) {
+		memcpy(word, source, 16);
+		sum += (u_int64_t) word[0] + word[1] + word[2] + word[3];
+		source += 16;
+		count -= 16;
+	}
+	while (count >= 4) {
+		memcpy(word, source, 4);
+		sum += word[0];
+		source += 4;
+		count -= 4;
+	}
+	if (count >= 2) {
+		memcpy(&tmp, source, 2);
+		sum += tmp;
+		source += 2;
 		count -= 2;
 	}
 
@@ -102,67 +173,132 @@ u_int16_t checksum(void *addr, int count)
 	if (count > 0) {
 		/* Make sure that the left-over byte is added correctly both
 		 * with little and big endian hosts */
-		u_int16_t tmp = 0;
-		*(unsigned char *) (&tmp) = * (unsigned char *) source;
+		tmp = 0;
+		*(unsigned char *) (&tmp) = *source;
 		sum += tmp;
 	}
-	/*  Fold 32-bit sum to 16 bits */
+	return sum;
+}
+
+
+/* Fold a sum from checksum_add() to 16 bits, and complement it */
+static u_int16_t checksum_fold(u_int64_t sum)
+{
 	while (sum >> 16)
 		sum = (sum & 0xffff) + (sum >> 16);
-
 	return ~sum;
 }
 
 
-/* Constuct a ip/udp header for a packet, and specify the source and dest hardware address */
-int raw_packet(struct dhcpMessage *payload, u_int32_t source_ip, int source_port,
-		   u_int32_t dest_ip, int dest_port, unsigned char *dest_arp, int ifindex)
+/* Compute Internet Checksum for "count" bytes beginning at location "addr" */
+u_int16_t checksum(void *addr, int count)
+{
+	return checksum_fold(checksum_add(0, addr, count));
+}
+
+
+/* the UDP checksum of the first len bytes of packet, the addresses of its
+ * ip header and the udp header with a zero checksum already filled in */
+u_int16_t udp_checksum(struct udp_dhcp_packet *packet, int len)
+{
+	struct {
+		u_int32_t saddr;
+		u_int32_t daddr;
+		u_int8_t zero;
+		u_int8_t protocol;
+		u_int16_t len;
+	} pseudo;
+
+	pseudo.saddr = packet->ip.saddr;
+	pseudo.daddr = packet->ip.daddr;
+	pseudo.zero = 0;
+	pseudo.protocol = IPPROTO_UDP;
+	pseudo.len = packet->udp.len;
+	return checksum_fold(checksum_add(checksum_add(0, &pseudo, sizeof(pseudo)),
+					  &(packet->udp), len - sizeof(packet->ip)));
+}
+
+
+/* open a socket to send frames on with raw_frame(), with protocol 0
+ * it is not handed any of the frames we receive */
+int raw_tx_socket(void)
 {
 	int fd;
-	int result;
-	struct sockaddr_ll dest;
-	struct udp_dhcp_packet packet;
 
 	/* 用于发送报文的原始UDP套接字 */
-	if ((fd = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) < 0) {
+	if ((fd = socket(PF_PACKET, SOCK_DGRAM, 0)) < 0)
 		DEBUG(LOG_ERR, "socket call failed: %s", strerror(errno));
-		return -1;
-	}
-	
-	memset(&dest, 0, sizeof(dest));
-	memset(&packet, 0, sizeof(packet));
+	return fd;
+}
+
+
+/* fill in dest to send a frame to the dest hardware address through ifindex */
+void frame_dest(struct sockaddr_ll *dest, unsigned char *dest_arp, int ifindex)
+{
+	memset(dest, 0, sizeof(struct sockaddr_ll));
 	
-	dest.sll_family = AF_PACKET;
-	dest.sll_protocol = htons(ETH_P_IP);
-	dest.sll_ifindex = ifindex;// XX_PACKET的套接字绑定interface需要用sockaddr_ll结构
-	dest.sll_halen = 6;
-	memcpy(dest.sll_addr, dest_arp, 6);
-	if (bind(fd, (struct sockaddr *)&dest, sizeof(struct sockaddr_ll)) < 0) {
-		DEBUG(LOG_ERR, "bind call failed: %s", strerror(errno));
-		close(fd);
-		return -1;
-	}
+	dest->sll_family = AF_PACKET;
+	dest->sll_protocol = htons(ETH_P_IP);
+	dest->sll_ifindex = ifindex;// XX_PACKET的套接字用sockaddr_ll结构指定interface
+	dest->sll_halen = 6;
+	memcpy(dest->sll_addr, dest_arp, 6);
+}
 
-	packet.ip.protocol = IPPROTO_UDP;
-	packet.ip.saddr = source_ip;
-	packet.ip.daddr = dest_ip;
-	packet.udp.source = htons(source_port);
-	packet.udp.dest = htons(dest_port);
-	packet.udp.len = htons(sizeof(packet.udp) + sizeof(struct dhcpMessage)); /* cheat on the psuedo-header */
-	packet.ip.tot_len = packet.udp.len;
-	memcpy(&(packet.data), payload, sizeof(struct dhcpMessage));
-	packet.udp.check = checksum(&packet, sizeof(struct udp_dhcp_packet));
+
+/* Constuct a ip/udp header for a frame whose payload is already in place,
+ * returns the length of the frame */
+int make_frame(struct udp_dhcp_packet *packet, u_int32_t source_ip, int source_port,
+		   u_int32_t dest_ip, int dest_port)
+{
+	int len = sizeof(packet->ip) + sizeof(packet->udp) + dhcp_packet_len(&(packet->data));
+
+	/* only the headers need clearing, the frame may have been sent before */
+	memset(&(packet->ip), 0, sizeof(packet->ip));
+	packet->ip.protocol = IPPROTO_UDP;
+	packet->ip.saddr = source_ip;
+	packet->ip.daddr = dest_ip;
+	packet->udp.source = htons(source_port);
+	packet->udp.dest = htons(dest_port);
+	packet->udp.len = htons(len - sizeof(packet->ip));
+	packet->udp.check = 0;
+	packet->udp.check = udp_checksum(packet, len);
 	
-	packet.ip.tot_len = htons(sizeof(struct udp_dhcp_packet));
-	packet.ip.ihl = sizeof(packet.ip) >> 2;
-	packet.ip.version = IPVERSION;
-	packet.ip.ttl = IPDEFTTL;
-	packet.ip.check = checksum(&(packet.ip), sizeof(packet.ip));
+	packet->ip.tot_len = htons(len);
+	packet->ip.ihl = sizeof(packet->ip) >> 2;
+	packet->ip.version = IPVERSION;
+	packet->ip.ttl = IPDEFTTL;
+	packet->ip.check = checksum(&(packet->ip), sizeof(packet->ip));
+	return len;
+}
+
+
+/* make the frame and send it on fd to the dest hardware address through ifindex */
+int raw_frame(int fd, struct udp_dhcp_packet *packet, u_int32_t source_ip, int source_port,
+		   u_int32_t dest_ip, int dest_port, unsigned char *dest_arp, int ifindex)
+{
+	int result, len;
+	struct sockaddr_ll dest;
 
-	result = sendto(fd, &packet, sizeof(struct udp_dhcp_packet), 0, (struct sockaddr *) &dest, sizeof(dest));
+	frame_dest(&dest, dest_arp, ifindex);
+	len = make_frame(packet, source_ip, source_port, dest_ip, dest_port);
+	result = sendto(fd, packet, len, 0, (struct sockaddr *) &dest, sizeof(dest));
 	if (result <= 0) {
 		DEBUG(LOG_ERR, "write on socket failed: %s", strerror(errno));
 	}
+	return result;
+}
+
+
+/* copy payload into a frame of its own and send it with raw_frame() on a socket of its own */
+int raw_packet(struct dhcpMessage *payload, u_int32_t source_ip, int source_port,
+		   u_int32_t dest_ip, int dest_port, unsigned char *dest_arp, int ifindex)
+{
+	int fd, result;
+	struct udp_dhcp_packet packet;
+
+	if ((fd = raw_tx_socket()) < 0) return -1;
+	memcpy(&(packet.data), payload, sizeof(struct dhcpMessage));
+	result = raw_frame(fd, &packet, source_ip, source_port, dest_ip, dest_port, dest_arp, ifindex);
 	close(fd);
 	return result;
 }
@@ -179,26 +315,32 @@ int kernel_packet(struct dhcpMessage *payload, u_int32_t source_ip, int source_p
 	if ((fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
 		return -1;
 	
-	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &n, sizeof(n)) == -1)
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &n, sizeof(n)) == -1) {
+		close(fd);
 		return -1;
+	}
 
 	memset(&client, 0, sizeof(client));
 	client.sin_family = AF_INET;
 	client.sin_port = htons(source_port);
 	client.sin_addr.s_addr = source_ip;
 
-	if (bind(fd, (struct sockaddr *)&client, sizeof(struct sockaddr)) == -1)
+	if (bind(fd, (struct sockaddr *)&client, sizeof(struct sockaddr)) == -1) {
+		close(fd);
 		return -1;
+	}
 
 	memset(&client, 0, sizeof(client));
 	client.sin_family = AF_INET;
 	client.sin_port = htons(dest_port);
 	client.sin_addr.s_addr = dest_ip; 
 
-	if (connect(fd, (struct sockaddr *)&client, sizeof(struct sockaddr)) == -1)
+	if (connect(fd, (struct sockaddr *)&client, sizeof(struct sockaddr)) == -1) {
+		close(fd);
 		return -1;
+	}
 	// write在向socket写数据时是阻塞的
-	result = write(fd, payload, sizeof(struct dhcpMessage));
+	result = write(fd, payload, dhcp_packet_len(payload));
 	close(fd);
 	return result;
 }	
@@ -25,15 +25,30 @@ struct dhcpMessage {
 	u_int8_t options[308];  /* 312 - cookie */ 
 };
 
+/* the size of a BOOTP message, shorter packets are padded out to it */
+#define BOOTP_MIN_LEN	300
+
 struct udp_dhcp_packet {
 	struct iphdr ip;
 	struct udphdr udp;
 	struct dhcpMessage data;
 };
 
+struct option_index;
+struct sockaddr_ll;
+
 void init_header(struct dhcpMessage *packet, char type);
-int get_packet(struct dhcpMessage *packet, int fd);
+int dhcp_packet_len(struct dhcpMessage *payload);
+int get_packet(struct dhcpMessage *packet, struct option_index *index, int fd);
+int get_packets(struct dhcpMessage *packets, struct option_index *index, int count, int fd);
 u_int16_t checksum(void *addr, int count);
+u_int16_t udp_checksum(struct udp_dhcp_packet *packet, int len);
+int raw_tx_socket(void);
+void frame_dest(struct sockaddr_ll *dest, unsigned char *dest_arp, int ifindex);
+int make_frame(struct udp_dhcp_packet *packet, u_int32_t source_ip, int source_port,
+		   u_int32_t dest_ip, int dest_port);
+int raw_frame(int fd, struct udp_dhcp_packet *packet, u_int32_t source_ip, int source_port,
+		   u_int32_t dest_ip, int dest_port, unsigned char *dest_arp, int ifindex);
 int raw_packet(struct dhcpMessage *payload, u_int32_t source_ip, int source_port,
 		   u_int32_t dest_ip, int dest_port, unsigned char *dest_arp, int ifindex);
 int kernel_packet(struct dhcpMessage *payload, u_int32_t source_ip, int source_port,
@@ -19,29 +19,202 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#define _GNU_SOURCE		/* for sendmmsg() */
 #include <sys/socket.h>
+#include <netpacket/packet.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <time.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "packet.h"
 #include "debug.h"
 #include "dhcpd.h"
 #include "options.h"
 #include "leases.h"
+#include "arpping.h"
+#include "socket.h"
+#include "serverpacket.h"
+#include "static_leases.h"
 
-/* send a packet to giaddr using the kernel ip stack */
+/* replies to clients on our link are built in place in the frames they
+ * are sent in, and wait here for flush_replies() to send them together */
+static struct udp_dhcp_packet tx_queue[REPLY_QUEUE_SIZE];
+static struct sockaddr_ll tx_dest[REPLY_QUEUE_SIZE];
+static int tx_queued;
+
+/* the socket replies to clients on our link go out on, it is
+ * opened on first use and again after a send error */
+static int tx_socket = -1;
+
+
+/* the socket bound to our address and the server port that replies to
+ * relays, and to clients that have an address, go out on. Requests
+ * unicast to us come in on it too */
+int relay_socket = -1;
+
+/* the same for replies sent through the IP stack: to relays, and to
+ * clients that have an address */
+static struct dhcpMessage relay_queue[REPLY_QUEUE_SIZE];
+static int relay_queued;
+
+
+/* open the relay socket, returns the fd or -1 */
+int open_relay_socket(void)
+{
+	struct sockaddr_in addr;
+	int n = 1;
+
+	if ((relay_socket = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+		LOG(LOG_ERR, "Could not open relay socket: %s", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(SERVER_PORT);
+	addr.sin_addr.s_addr = server_config.server;
+	if (setsockopt(relay_socket, SOL_SOCKET, SO_REUSEADDR, (char *) &n, sizeof(n)) < 0 ||
+	    bind(relay_socket, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		LOG(LOG_ERR, "Could not set up relay socket: %s", strerror(errno));
+		close(relay_socket);
+		relay_socket = -1;
+	} else attach_server_filter(relay_socket);
+	return relay_socket;
+}
+
+
+/* send count messages on fd with as few sendmmsg() calls as we can, one
+ * that cannot be sent is counted and skipped. Returns the errno of the
+ * last failure, or 0 */
+static int send_queue(int fd, struct mmsghdr *msgs, int count)
+{
+	int ret, sent = 0, err = 0;
+
+	/* sendmmsg() stops at the first message it cannot send */
+	while (sent < count) {
+		if ((ret = sendmmsg(fd, msgs + sent, count - sent, 0)) > 0) {
+			server_stats.tx_packets += ret;
+			sent += ret;
+		} else {
+			err = errno;
+			DEBUG(LOG_ERR, "Could not send reply: %s", strerror(err));
+			server_stats.tx_errors++;
+			sent++;
+		}
+	}
+	return err;
+}
+
+
+/* send the replies waiting in the queues */
+void flush_replies(void)
+{
+	struct mmsghdr msgs[REPLY_QUEUE_SIZE];
+	struct iovec iov[REPLY_QUEUE_SIZE];
+	struct sockaddr_in addr[REPLY_QUEUE_SIZE];
+	int i, err;
+
+	if (tx_queued) {
+		memset(msgs, 0, sizeof(struct mmsghdr) * tx_queued);
+		for (i = 0; i < tx_queued; i++) {
+			iov[i].iov_base = &tx_queue[i];
+			iov[i].iov_len = ntohs(tx_queue[i].ip.tot_len);
+			msgs[i].msg_hdr.msg_name = &tx_dest[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		if (tx_socket < 0 && (tx_socket = raw_tx_socket()) < 0)
+			server_stats.tx_errors += tx_queued;
+		else if ((err = send_queue(tx_socket, msgs, tx_queued))) {
+			/* the interface may have been recreated under a new index */
+			if (err == ENXIO || err == ENODEV)
+				read_interface(server_config.interface, &server_config.ifindex,
+					       NULL, server_config.arp);
+			close(tx_socket);
+			tx_socket = -1;
+		}
+		tx_queued = 0;
+	}
+
+	if (relay_queued) {
+		memset(msgs, 0, sizeof(struct mmsghdr) * relay_queued);
+		memset(addr, 0, sizeof(struct sockaddr_in) * relay_queued);
+		for (i = 0; i < relay_queued; i++) {
+			addr[i].sin_family = AF_INET;
+			if (relay_queue[i].giaddr) {
+				addr[i].sin_port = htons(SERVER_PORT);
+				addr[i].sin_addr.s_addr = relay_queue[i].giaddr;
+			} else {
+				addr[i].sin_port = htons(CLIENT_PORT);
+				addr[i].sin_addr.s_addr = relay_queue[i].ciaddr;
+			}
+			iov[i].iov_base = &relay_queue[i];
+			iov[i].iov_len = dhcp_packet_len(&relay_queue[i]);
+			msgs[i].msg_hdr.msg_name = &addr[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		send_queue(relay_socket, msgs, relay_queued);
+		relay_queued = 0;
+	}
+}
+
+
+/* where to build the reply to oldpacket: the next free slot of the queue it
+ * will be sent from. A NAK to a client with ciaddr is broadcast after all,
+ * then it is sent from where it was built */
+static struct dhcpMessage *reply_buffer(struct dhcpMessage *oldpacket)
+{
+	if ((oldpacket->giaddr || oldpacket->ciaddr) && relay_socket >= 0) {
+		if (relay_queued == REPLY_QUEUE_SIZE)
+			flush_replies();
+		return &relay_queue[relay_queued];
+	}
+	if (tx_queued == REPLY_QUEUE_SIZE)
+		flush_replies();
+	return &tx_queue[tx_queued].data;
+}
+
+
+/* send a packet to giaddr using the kernel ip stack. One built in the
+ * relay queue is just kept there, and 0 is returned */
 static int send_packet_to_relay(struct dhcpMessage *payload)
 {
 	DEBUG(LOG_INFO, "Forwarding packet to relay");
 
+	if (relay_queued < REPLY_QUEUE_SIZE && payload == &relay_queue[relay_queued]) {
+		relay_queued++;
+		return 0;
+	}
 	return kernel_packet(payload, server_config.server, SERVER_PORT,
 			payload->giaddr, SERVER_PORT);
 }
 
 
-/* send a packet to a specific arp address and ip address by creating our own ip packet */
+/* send a packet to a client that has an address, ciaddr, using the kernel
+ * ip stack, it may be behind a relay. One built in the relay queue is just
+ * kept there, and 0 is returned */
+static int send_packet_to_ciaddr(struct dhcpMessage *payload)
+{
+	DEBUG(LOG_INFO, "unicasting packet to client ciaddr");
+
+	if (relay_queued < REPLY_QUEUE_SIZE && payload == &relay_queue[relay_queued]) {
+		relay_queued++;
+		return 0;
+	}
+	return kernel_packet(payload, server_config.server, SERVER_PORT,
+			payload->ciaddr, CLIENT_PORT);
+}
+
+
+/* send a packet to a specific arp address and ip address by creating our own ip packet.
+ * The frame of one built in the queue is made and kept there, and 0 is returned */
 static int send_packet_to_client(struct dhcpMessage *payload, int force_broadcast)
 {
 	unsigned char *chaddr;
@@ -51,10 +224,6 @@ static int send_packet_to_client(struct dhcpMessage *payload, int force_broadcas
 		DEBUG(LOG_INFO, "broadcasting packet to client (NAK)");
 		ciaddr = INADDR_BROADCAST;
 		chaddr = MAC_BCAST_ADDR;
-	} else if (payload->ciaddr) {
-		DEBUG(LOG_INFO, "unicasting packet to client ciaddr");
-		ciaddr = payload->ciaddr;
-		chaddr = payload->chaddr;
 	} else if (ntohs(payload->flags) & BROADCAST_FLAG) {
 		DEBUG(LOG_INFO, "broadcasting packet to client (requested)");
 		ciaddr = INADDR_BROADCAST;
@@ -64,8 +233,14 @@ static int send_packet_to_client(struct dhcpMessage *payload, int force_broadcas
 		ciaddr = payload->yiaddr;
 		chaddr = payload->chaddr;
 	}
-	return raw_packet(payload, server_config.server, SERVER_PORT, 
-			ciaddr, CLIENT_PORT, chaddr, server_config.ifindex);
+
+	if (tx_queued == REPLY_QUEUE_SIZE || payload != &tx_queue[tx_queued].data)
+		return raw_packet(payload, server_config.server, SERVER_PORT, 
+				ciaddr, CLIENT_PORT, chaddr, server_config.ifindex);
+	frame_dest(&tx_dest[tx_queued], chaddr, server_config.ifindex);
+	make_frame(&tx_queue[tx_queued], server_config.server, SERVER_PORT, ciaddr, CLIENT_PORT);
+	tx_queued++;
+	return 0;
 }
 
 
@@ -76,7 +251,12 @@ static int send_packet(struct dhcpMessage *payload, int force_broadcast)
 	/* giaddr是跨网域发包的目的地址 */
 	if (payload->giaddr)
 		ret = send_packet_to_relay(payload);
+	/* RFC 2131 4.1: a client with an address is sent its reply by IP */
+	else if (payload->ciaddr && !force_broadcast)
+		ret = send_packet_to_ciaddr(payload);
 	else ret = send_packet_to_client(payload, force_broadcast);
+	if (ret < 0) server_stats.tx_errors++;
+	else if (ret) server_stats.tx_packets++;
 	return ret;
 }
 
@@ -93,6 +273,25 @@ static void init_packet(struct dhcpMessage *packet, struct dhcpMessage *oldpacke
 }
 
 
+/* add in the options from the config file but the lease time, those
+ * of the client's pool take the place of the global ones. They were laid
+ * out by read_config(), and always fit after the few options set before */
+static void add_config_options(struct dhcpMessage *packet)
+{
+	struct pool_t *pool = find_pool(packet->giaddr);
+	unsigned char *blob = server_config.option_blob;
+	int len = server_config.option_blob_len, end;
+
+	if (pool && pool->option_blob) {
+		blob = pool->option_blob;
+		len = pool->option_blob_len;
+	}
+	end = end_option(packet->options);
+	memcpy(packet->options + end, blob, len);
+	packet->options[end + len] = DHCP_END;
+}
+
+
 /* add in the bootp options */
 static void add_bootp_options(struct dhcpMessage *packet)
 {
@@ -104,117 +303,258 @@ static void add_bootp_options(struct dhcpMessage *packet)
 }
 	
 
-/* send a DHCP OFFER to a DHCP DISCOVER */
-int sendOffer(struct dhcpMessage *oldpacket)
+/* build and send the OFFER of yiaddr, lease_time_align is the lease we would like to give */
+static int send_offer(struct dhcpMessage *oldpacket, struct option_index *opts,
+		      u_int32_t yiaddr, u_int32_t lease_time_align)
 {
-	struct dhcpMessage packet;
-	struct dhcpOfferedAddr *lease = NULL;
-	u_int32_t req_align, lease_time_align = server_config.lease;
-	unsigned char *req, *lease_time;
-	struct option_set *curr;
+	struct dhcpMessage *packet = reply_buffer(oldpacket);
+	unsigned char *lease_time;
 	struct in_addr addr;
 
-	init_packet(&packet, oldpacket, DHCPOFFER);
+	init_packet(packet, oldpacket, DHCPOFFER);
+	packet->yiaddr = yiaddr;
 	
-	/* ADDME: if static, short circuit */
-	/* the client is in our lease/offered table */
-	if ((lease = find_lease_by_chaddr(oldpacket->chaddr))) {
+	if (!add_lease(packet->chaddr, packet->yiaddr, server_config.offer_time)) {
+		LOG(LOG_WARNING, "lease pool is full -- OFFER abandoned");
+		return -1;
+	}		
+
+	if ((lease_time = indexed_option(oldpacket, opts, DHCP_LEASE_TIME))) {
+		memcpy(&lease_time_align, lease_time, 4);
+		lease_time_align = ntohl(lease_time_align);
+		if (lease_time_align > server_config.lease) 
+			lease_time_align = server_config.lease;
+	}
+
+	/* Make sure we aren't just using the lease time from the previous offer */
+	if (lease_time_align < server_config.min_lease) 
+		lease_time_align = server_config.lease;
+	add_simple_option(packet->options, DHCP_LEASE_TIME, htonl(lease_time_align));
+
+	add_config_options(packet);
+
+	add_bootp_options(packet);
+	
+	addr.s_addr = packet->yiaddr;
+	LOG(LOG_INFO, "sending OFFER of %s", inet_ntoa(addr));
+	return send_packet(packet, 0);
+}
+
+
+/* OFFERs waiting for the ARP probe of their address, the address is
+ * reserved for the client while the probe runs */
+static struct arp_probe {
+	struct dhcpMessage packet;	/* the DISCOVER */
+	struct option_index opts;	/* and its options */
+	u_int32_t yiaddr;
+	struct timeval deadline;
+	int active;
+} probes[MAX_ARP_PROBES];
+static int active_probes;
+
+
+/* pick an address for the DISCOVER in probe, reserve it and ARP it */
+static void start_probe(struct arp_probe *probe)
+{
+	int cached = -1;
+
+	/* try for an expired lease too, skipping addresses a recent probe found taken */
+	while ((probe->yiaddr = find_address(server_config.pools, 1)) &&
+	       (cached = arp_cache_lookup(probe->yiaddr)) == 0)
+		mark_conflict(probe->yiaddr);
+
+	if (!probe->yiaddr)
+		LOG(LOG_WARNING, "no IP addresses to give -- OFFER abandoned");
+	else if (cached == 1) {
+		/* a recent probe found it free, offer it right away */
+		probe->active = 0;
+		active_probes--;
+		if (send_offer(&probe->packet, &probe->opts, probe->yiaddr, server_config.lease) < 0)
+			LOG(LOG_ERR, "send OFFER failed");
+		return;
+	} else if (!add_lease(probe->packet.chaddr, probe->yiaddr, server_config.offer_time))
+		LOG(LOG_WARNING, "lease pool is full -- OFFER abandoned");
+	else if (send_arp_probe(probe->yiaddr, server_config.server, server_config.arp) < 0)
+		LOG(LOG_ERR, "could not ARP probe -- OFFER abandoned");
+	else {
+		DEBUG(LOG_INFO, "probing %08x before the OFFER", ntohl(probe->yiaddr));
+		gettimeofday(&probe->deadline, NULL);
+		probe->deadline.tv_sec += ARP_PROBE_TIME;
+		return;
+	}
+	probe->active = 0;
+	active_probes--;
+}
+
+
+/* send a DHCP OFFER to a DHCP DISCOVER */
+int sendOffer(struct dhcpMessage *oldpacket, struct option_index *opts)
+{
+	struct dhcpOfferedAddr *lease = NULL;
+	u_int32_t req_align, yiaddr, lease_time_align = server_config.lease;
+	unsigned char *req;
+	struct arp_probe *probe, *unused = NULL;
+	struct pool_t *pool;
+
+	if (!(pool = find_pool(oldpacket->giaddr))) return -1;
+
+	/* the client already has a probe running, just answer its latest DISCOVER */
+	for (probe = probes; probe < probes + MAX_ARP_PROBES; probe++) {
+		if (!probe->active) {
+			if (!unused) unused = probe;
+		} else if (!memcmp(probe->packet.chaddr, oldpacket->chaddr, 16)) {
+			memcpy(&probe->packet, oldpacket, sizeof(struct dhcpMessage));
+			memcpy(&probe->opts, opts, sizeof(struct option_index));
+			return 0;
+		}
+	}
+	
+	/* the client has an address reserved, that short circuits the pool, as
+	 * long as it is on the subnet of that address */
+	if ((yiaddr = static_ip_by_chaddr(oldpacket->chaddr)) &&
+	    reserved_pool(yiaddr) == pool) {
+		DEBUG(LOG_INFO, "offering reserved address %08x", ntohl(yiaddr));
+
+	/* the client is in our lease/offered table, for the subnet it is on now */
+	} else if ((lease = find_lease_by_chaddr(oldpacket->chaddr)) &&
+	    find_pool_by_yiaddr(lease->yiaddr) == pool) {
 		if (!lease_expired(lease)) 
 			lease_time_align = lease->expires - time(0);
-		packet.yiaddr = lease->yiaddr;
+		yiaddr = lease->yiaddr;
 		
 	/* Or the client has a requested ip */
-	} else if ((req = get_option(oldpacket, DHCP_REQUESTED_IP)) &&
+	} else if ((req = indexed_option(oldpacket, opts, DHCP_REQUESTED_IP)) &&
 
 		   /* Don't look here (ugly hackish thing to do) */
 		   memcpy(&req_align, req, 4) &&
 
 		   /* and the ip is in the lease range */
-		   ntohl(req_align) >= ntohl(server_config.start) &&
-		   ntohl(req_align) <= ntohl(server_config.end) &&
+		   find_pool_by_yiaddr(req_align) == pool &&
 		   
-		   /* and its not already taken/offered */ /* ADDME: check that its not a static lease */
+		   /* and its not reserved for someone else */
+		   !static_ip_reserved(req_align) &&
+
+		   /* and its not already taken/offered */
 		   ((!(lease = find_lease_by_yiaddr(req_align)) ||
 		   
-		   /* or its taken, but expired */ /* ADDME: or maybe in here */
+		   /* or its taken, but expired */
 		   lease_expired(lease)))) {
-				packet.yiaddr = req_align; /* FIXME: oh my, is there a host using this IP? */
-
-	/* otherwise, find a free IP */ /*ADDME: is it a static lease? */
+				yiaddr = req_align; /* FIXME: oh my, is there a host using this IP? */
+
+	/* relayed clients are not on our link, there is nobody we could ARP */
+	} else if (pool != server_config.pools) {
+		yiaddr = find_address(pool, 1);
+
+	/* otherwise, find a free IP, ARP probing it without holding up other clients */
+	} else if (arp_socket >= 0) {
+		if (!unused) {
+			DEBUG(LOG_INFO, "too many ARP probes running, ignoring DISCOVER");
+			return -1;
+		}
+		memcpy(&unused->packet, oldpacket, sizeof(struct dhcpMessage));
+		memcpy(&unused->opts, opts, sizeof(struct option_index));
+		unused->active = 1;
+		active_probes++;
+		start_probe(unused);
+		return 0;
+
+	/* or without the ARP socket, the old blocking way */
 	} else {
-		packet.yiaddr = find_address(0);
-		
-		/* try for an expired lease */
-		if (!packet.yiaddr) packet.yiaddr = find_address(1);
+		/* try for an expired lease too */
+		while ((yiaddr = find_address(pool, 1)) && check_ip(yiaddr));
 	}
 	
-	if(!packet.yiaddr) {
+	if (!yiaddr) {
 		LOG(LOG_WARNING, "no IP addresses to give -- OFFER abandoned");
 		return -1;
 	}
 	
-	if (!add_lease(packet.chaddr, packet.yiaddr, server_config.offer_time)) {
-		LOG(LOG_WARNING, "lease pool is full -- OFFER abandoned");
-		return -1;
-	}		
+	return send_offer(oldpacket, opts, yiaddr, lease_time_align);
+}
 
-	if ((lease_time = get_option(oldpacket, DHCP_LEASE_TIME))) {
-		memcpy(&lease_time_align, lease_time, 4);
-		lease_time_align = ntohl(lease_time_align);
-		if (lease_time_align > server_config.lease) 
-			lease_time_align = server_config.lease;
-	}
 
-	/* Make sure we aren't just using the lease time from the previous offer */
-	if (lease_time_align < server_config.min_lease) 
-		lease_time_align = server_config.lease;
-	/* ADDME: end of short circuit */		
-	add_simple_option(packet.options, DHCP_LEASE_TIME, htonl(lease_time_align));
-
-	curr = server_config.options;
-	while (curr) {
-		if (curr->data[OPT_CODE] != DHCP_LEASE_TIME)
-			add_option_string(packet.options, curr->data);
-		curr = curr->next;
-	}
+/* the owner of addr answered our ARP probe, move its OFFER to another address */
+void probe_conflict(u_int32_t addr)
+{
+	struct arp_probe *probe;
+
+	for (probe = probes; probe < probes + MAX_ARP_PROBES; probe++)
+		if (probe->active && probe->yiaddr == addr) {
+			arp_cache_store(addr, 0);
+			mark_conflict(addr);
+			start_probe(probe);
+		}
+}
 
-	add_bootp_options(&packet);
-	
-	addr.s_addr = packet.yiaddr;
-	LOG(LOG_INFO, "sending OFFER of %s", inet_ntoa(addr));
-	return send_packet(&packet, 0);
+
+/* time left until the next probe window ends, returns 0 if no probe is running */
+int probe_timeout(struct timeval *tv)
+{
+	struct arp_probe *probe;
+	struct timeval now;
+	int found = 0;
+
+	if (!active_probes) return 0;
+	for (probe = probes; probe < probes + MAX_ARP_PROBES; probe++)
+		if (probe->active && (!found || timercmp(&probe->deadline, tv, <))) {
+			*tv = probe->deadline;
+			found = 1;
+		}
+
+	gettimeofday(&now, NULL);
+	if (timercmp(tv, &now, <)) timerclear(tv);
+	else timersub(tv, &now, tv);
+	return found;
+}
+
+
+/* send the OFFERs whose address stayed quiet for the whole probe window */
+void finish_probes(void)
+{
+	struct arp_probe *probe;
+	struct timeval now;
+
+	if (!active_probes) return;
+	gettimeofday(&now, NULL);
+	for (probe = probes; probe < probes + MAX_ARP_PROBES; probe++)
+		if (probe->active && !timercmp(&now, &probe->deadline, <)) {
+			probe->active = 0;
+			active_probes--;
+			arp_cache_store(probe->yiaddr, 1);
+			if (send_offer(&probe->packet, &probe->opts, probe->yiaddr, server_config.lease) < 0)
+				LOG(LOG_ERR, "send OFFER failed");
+		}
 }
 
 
 int sendNAK(struct dhcpMessage *oldpacket)
 {
-	struct dhcpMessage packet;
+	struct dhcpMessage *packet = reply_buffer(oldpacket);
 
-	init_packet(&packet, oldpacket, DHCPNAK);
+	init_packet(packet, oldpacket, DHCPNAK);
 	
 	DEBUG(LOG_INFO, "sending NAK");
 	/* NAK报文是广播形式通知client */
-	return send_packet(&packet, 1);
+	return send_packet(packet, 1);
 }
 
 
-int sendACK(struct dhcpMessage *oldpacket, u_int32_t yiaddr)
+int sendACK(struct dhcpMessage *oldpacket, struct option_index *opts, u_int32_t yiaddr)
 {
-	struct dhcpMessage packet;
-	struct option_set *curr;
+	struct dhcpMessage *packet = reply_buffer(oldpacket);
 	unsigned char *lease_time;
 	u_int32_t lease_time_align = server_config.lease;
 	struct in_addr addr;
 
 	/* 先清空报文数据，封装部分头部信息 */
-	init_packet(&packet, oldpacket, DHCPACK);
-	packet.yiaddr = yiaddr;
+	init_packet(packet, oldpacket, DHCPACK);
+	packet->yiaddr = yiaddr;
 	
 	/* 
 		如果请求报文规定了DHCP_LEASE_TIME且 server_config.min_lease < DHCP_LEASE_TIME < erver_config.lease
 		则使用客户端要求的DHCP_LEASE_TIME，否则使用默认的server_config.lease
 	*/
-	if ((lease_time = get_option(oldpacket, DHCP_LEASE_TIME))) {
+	if ((lease_time = indexed_option(oldpacket, opts, DHCP_LEASE_TIME))) {
 		memcpy(&lease_time_align, lease_time, 4);
 		lease_time_align = ntohl(lease_time_align);
 		if (lease_time_align > server_config.lease) 
@@ -223,27 +563,22 @@ int sendACK(struct dhcpMessage *oldpacket, u_int32_t yiaddr)
 			lease_time_align = server_config.lease;
 	}
 	
-	add_simple_option(packet.options, DHCP_LEASE_TIME, htonl(lease_time_align));
+	add_simple_option(packet->options, DHCP_LEASE_TIME, htonl(lease_time_align));
 	
 	/* 将配置文件中的opt选项添加到报文中(除了DHCP_LEASE_TIME的设置,因为前面已经设置过了) */
-	curr = server_config.options;
-	while (curr) {
-		if (curr->data[OPT_CODE] != DHCP_LEASE_TIME)
-			add_option_string(packet.options, curr->data);
-		curr = curr->next;
-	}
+	add_config_options(packet);
 
-	add_bootp_options(&packet);
+	add_bootp_options(packet);
 
-	addr.s_addr = packet.yiaddr;
+	addr.s_addr = packet->yiaddr;
 	LOG(LOG_INFO, "sending ACK to %s", inet_ntoa(addr));
 
 	/* 发送报文 */
-	if (send_packet(&packet, 0) < 0) 
+	if (send_packet(packet, 0) < 0) 
 		return -1;
 
 	/* 将分配的IP更新到lease链表 */
-	add_lease(packet.chaddr, packet.yiaddr, lease_time_align);
+	add_lease(packet->chaddr, packet->yiaddr, lease_time_align);
 
 	return 0;
 }
@@ -251,21 +586,15 @@ int sendACK(struct dhcpMessage *oldpacket, u_int32_t yiaddr)
 
 int send_inform(struct dhcpMessage *oldpacket)
 {
-	struct dhcpMessage packet;
-	struct option_set *curr;
+	struct dhcpMessage *packet = reply_buffer(oldpacket);
 
-	init_packet(&packet, oldpacket, DHCPACK);
+	init_packet(packet, oldpacket, DHCPACK);
 	
-	curr = server_config.options;
-	while (curr) {
-		if (curr->data[OPT_CODE] != DHCP_LEASE_TIME)
-			add_option_string(packet.options, curr->data);
-		curr = curr->next;
-	}
+	add_config_options(packet);
 
-	add_bootp_options(&packet);
+	add_bootp_options(packet);
 
-	return send_packet(&packet, 0);
+	return send_packet(packet, 0);
 }
 
 
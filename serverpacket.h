@@ -1,11 +1,22 @@
 #ifndef _SERVERPACKET_H
 #define _SERVERPACKET_H
 
+#include <sys/time.h>
 
-int sendOffer(struct dhcpMessage *oldpacket);
+
+struct option_index;
+
+extern int relay_socket;
+
+int open_relay_socket(void);
+void flush_replies(void);
+int sendOffer(struct dhcpMessage *oldpacket, struct option_index *opts);
 int sendNAK(struct dhcpMessage *oldpacket);
-int sendACK(struct dhcpMessage *oldpacket, u_int32_t yiaddr);
+int sendACK(struct dhcpMessage *oldpacket, struct option_index *opts, u_int32_t yiaddr);
 int send_inform(struct dhcpMessage *oldpacket);
+void probe_conflict(u_int32_t addr);
+int probe_timeout(struct timeval *tv);
+void finish_probes(void);
 
 
 #endif
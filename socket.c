@@ -41,6 +41,10 @@
 #include <linux/if_ether.h>
 #endif
 
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
+
+#include "dhcpd.h"
 #include "debug.h"
 
 int read_interface(char *interface, int *ifindex, u_int32_t *addr, unsigned char *arp)
@@ -153,18 +157,94 @@ int listen_socket(unsigned int ip, int port, char *inf)
 }
 
 
-int raw_socket(int ifindex)
+/* Only let UDP to the client port for our hardware address through to a
+ * raw socket, so the rest of the traffic on the link never leaves the
+ * kernel. Offsets are from the IP header, as the socket is SOCK_DGRAM. */
+static int attach_client_filter(int fd, unsigned char *chaddr)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 6),			/* not a later fragment */
+		BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 0x1fff, 10, 0),
+		BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 9),			/* UDP */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 8),
+		BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 0),			/* X = IP header length */
+		BPF_STMT(BPF_LD + BPF_H + BPF_IND, 2),			/* to the client port */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, CLIENT_PORT, 0, 5),
+		BPF_STMT(BPF_LD + BPF_W + BPF_IND, 8 + 28),		/* chaddr is ours */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 3),
+		BPF_STMT(BPF_LD + BPF_H + BPF_IND, 8 + 32),
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 1),
+		BPF_STMT(BPF_RET + BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET + BPF_K, 0),
+	};
+	struct sock_fprog prog;
+
+	code[8].k = (chaddr[0] << 24) | (chaddr[1] << 16) | (chaddr[2] << 8) | chaddr[3];
+	code[10].k = (chaddr[4] << 8) | chaddr[5];
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+
+/* Only let BOOTREQUESTs with the DHCP cookie wake up the server. A UDP
+ * socket's filter sees the packet from the UDP header on. */
+int attach_server_filter(int fd)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD + BPF_W + BPF_LEN, 0),			/* long enough for the cookie */
+		BPF_JUMP(BPF_JMP + BPF_JGE + BPF_K, 8 + 240, 0, 5),
+		BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 8),			/* op */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, BOOTREQUEST, 0, 3),
+		BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 8 + 236),		/* cookie */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, DHCP_MAGIC, 0, 1),
+		BPF_STMT(BPF_RET + BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET + BPF_K, 0),
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+		LOG(LOG_INFO, "couldn't attach socket filter, checking every packet: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+/* packets the kernel dropped on fd, by its filter or for a full receive queue */
+unsigned long socket_drops(int fd)
+{
+#ifdef SO_MEMINFO
+	u_int32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+
+	if (fd >= 0 && getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0 &&
+	    len > SK_MEMINFO_DROPS * sizeof(u_int32_t))
+		return meminfo[SK_MEMINFO_DROPS];
+#endif
+	return 0;
+}
+
+
+int raw_socket(int ifindex, unsigned char *chaddr)
 {
 	int fd;
 	struct sockaddr_ll sock;
 
 	DEBUG(LOG_INFO, "Opening raw socket on ifindex %d\n", ifindex);
-	if ((fd = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) < 0) {
+	/* no protocol yet, so nothing is queued before the filter is on */
+	if ((fd = socket(PF_PACKET, SOCK_DGRAM, 0)) < 0) {
 		DEBUG(LOG_ERR, "socket call failed: %s", strerror(errno));
 		return -1;
 	}
 
+	if (attach_client_filter(fd, chaddr) < 0)
+		LOG(LOG_INFO, "couldn't attach socket filter, filtering in udhcpc: %s", strerror(errno));
+
 	/* PACKET的套接字不能使用SO_BINDTODEVICE绑定到interface,所以只能呢个使用sockaddr_ll结构绑定interface */
+	memset(&sock, 0, sizeof(sock));
 	sock.sll_family = AF_PACKET;
 	sock.sll_protocol = htons(ETH_P_IP);
 	sock.sll_ifindex = ifindex;
@@ -176,4 +256,3 @@ int raw_socket(int ifindex)
 
 	return fd;
 }
-
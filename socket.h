@@ -4,6 +4,8 @@
 
 int read_interface(char *interface, int *ifindex, u_int32_t *addr, unsigned char *arp);
 int listen_socket(unsigned int ip, int port, char *inf);
-int raw_socket(int ifindex);
+int raw_socket(int ifindex, unsigned char *chaddr);
+int attach_server_filter(int fd);
+unsigned long socket_drops(int fd);
 
 #endif
@@ -0,0 +1,155 @@
+/* 
+ * static_leases.c -- fixed addresses for known hardware addresses
+ *
+ * The reservations are read once at startup from static_file, one
+ * "xx:xx:xx:xx:xx:xx a.b.c.d" per line, and kept in two hash tables,
+ * by chaddr for the clients and by address for the pools.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "debug.h"
+#include "dhcpd.h"
+#include "static_leases.h"
+
+#define STATIC_NONE	((u_int32_t) -1)
+
+struct static_lease {
+	u_int8_t  chaddr[6];
+	u_int32_t yiaddr;		/* network order */
+	u_int32_t next_chaddr;		/* chains of the two hash tables */
+	u_int32_t next_yiaddr;
+};
+
+static struct static_lease *statics;
+static u_int32_t static_count;
+static u_int32_t *chaddr_buckets;
+static u_int32_t *yiaddr_buckets;
+static u_int32_t static_mask;
+
+
+static u_int32_t hash_chaddr(u_int8_t *chaddr)
+{
+	u_int32_t hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		hash = (hash ^ chaddr[i]) * 16777619U;
+	return hash & static_mask;
+}
+
+
+static u_int32_t hash_yiaddr(u_int32_t yiaddr)
+{
+	return (ntohl(yiaddr) * 2654435761U) & static_mask;
+}
+
+
+/* parse one "chaddr yiaddr" line into lease, returns 0 if it is not one */
+static int parse_static(char *line, struct static_lease *lease)
+{
+	unsigned int mac[6];
+	char ip[16];
+	struct in_addr addr;
+	int i;
+
+	if (sscanf(line, "%x:%x:%x:%x:%x:%x %15s", &mac[0], &mac[1], &mac[2],
+		   &mac[3], &mac[4], &mac[5], ip) != 7 || !inet_aton(ip, &addr))
+		return 0;
+	for (i = 0; i < 6; i++) {
+		if (mac[i] > 0xff) return 0;
+		lease->chaddr[i] = mac[i];
+	}
+	lease->yiaddr = addr.s_addr;
+	return 1;
+}
+
+
+/* load the reservations in file and hash them, returns the number read or -1 */
+int read_static_leases(char *file)
+{
+	FILE *fp;
+	char buffer[80];
+	struct static_lease lease, *new_statics;
+	u_int32_t size = 0, buckets, i, *bucket;
+
+	if (!(fp = fopen(file, "r"))) {
+		LOG(LOG_ERR, "Unable to open %s for reading", file);
+		return -1;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		if (strchr(buffer, '\n')) *(strchr(buffer, '\n')) = '\0';
+		if (strchr(buffer, '#')) *(strchr(buffer, '#')) = '\0';
+		if (buffer[strspn(buffer, " \t\r")] == '\0') continue;
+		if (!parse_static(buffer, &lease)) {
+			LOG(LOG_ERR, "unable to parse static lease '%s'", buffer);
+			continue;
+		}
+		if (static_count == size) {
+			size = size ? size * 2 : 64;
+			if (!(new_statics = xrealloc(statics, sizeof(struct static_lease) * size))) {
+				LOG(LOG_ERR, "Too many static leases in %s", file);
+				break;
+			}
+			statics = new_statics;
+		}
+		statics[static_count++] = lease;
+	}
+	fclose(fp);
+
+	for (buckets = 1; buckets < static_count; buckets <<= 1);
+	static_mask = buckets - 1;
+	chaddr_buckets = xmalloc(sizeof(u_int32_t) * buckets);
+	yiaddr_buckets = xmalloc(sizeof(u_int32_t) * buckets);
+	memset(chaddr_buckets, 0xff, sizeof(u_int32_t) * buckets);
+	memset(yiaddr_buckets, 0xff, sizeof(u_int32_t) * buckets);
+
+	/* chains are built back to front, so the first line for a chaddr wins */
+	for (i = static_count; i-- > 0;) {
+		bucket = &chaddr_buckets[hash_chaddr(statics[i].chaddr)];
+		statics[i].next_chaddr = *bucket;
+		*bucket = i;
+		bucket = &yiaddr_buckets[hash_yiaddr(statics[i].yiaddr)];
+		statics[i].next_yiaddr = *bucket;
+		*bucket = i;
+	}
+
+	DEBUG(LOG_INFO, "Read %u static leases", static_count);
+	return static_count;
+}
+
+
+u_int32_t static_lease_count(void)
+{
+	return static_count;
+}
+
+
+/* the address reserved for chaddr, 0 if there is none */
+u_int32_t static_ip_by_chaddr(u_int8_t *chaddr)
+{
+	u_int32_t i;
+
+	if (!static_count) return 0;
+	for (i = chaddr_buckets[hash_chaddr(chaddr)]; i != STATIC_NONE; i = statics[i].next_chaddr)
+		if (!memcmp(statics[i].chaddr, chaddr, 6)) return statics[i].yiaddr;
+	return 0;
+}
+
+
+/* true if yiaddr is reserved for some chaddr */
+int static_ip_reserved(u_int32_t yiaddr)
+{
+	u_int32_t i;
+
+	if (!static_count) return 0;
+	for (i = yiaddr_buckets[hash_yiaddr(yiaddr)]; i != STATIC_NONE; i = statics[i].next_yiaddr)
+		if (statics[i].yiaddr == yiaddr) return 1;
+	return 0;
+}
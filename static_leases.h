@@ -0,0 +1,10 @@
+/* static_leases.h */
+#ifndef _STATIC_LEASES_H
+#define _STATIC_LEASES_H
+
+int read_static_leases(char *file);
+u_int32_t static_lease_count(void);
+u_int32_t static_ip_by_chaddr(u_int8_t *chaddr);
+int static_ip_reserved(u_int32_t yiaddr);
+
+#endif